@@ -0,0 +1,2533 @@
+#include "analyzer.hpp"
+#include "repl.hpp"
+#include <algorithm>
+#include <iostream>
+#include <unordered_map>
+using std::make_shared;
+
+namespace ml {
+
+// SCOPE
+
+Scope::Scope(shared_ptr<Scope> outer, shared_ptr<Environment> env)
+    : outer(outer), env(env) {}
+
+unsigned int Scope::bind(const std::string &name) {
+  unsigned int index = visible.size();
+  visible.push_back({name, index});
+  if (visible.size() > size)
+    size = visible.size();
+  if (unboxed.size() < visible.size())
+    unboxed.resize(visible.size());
+  unboxed[index] = false;
+  return index;
+}
+
+void Scope::unbind(unsigned int count) {
+  visible.resize(visible.size() - count);
+}
+
+void Scope::rename(unsigned int index, const std::string &name) {
+  visible[index].first = name;
+}
+
+bool Scope::resolve(const std::string &name, unsigned int &depth,
+                    unsigned int &index) {
+  depth = 0;
+  for (Scope *s = this; s != nullptr; s = s->outer.get(), depth++) {
+    for (auto it = s->visible.rbegin(); it != s->visible.rend(); it++)
+      if (it->first == name) {
+        index = it->second;
+        return true;
+      }
+    if (s->enclosing != nullptr) {
+      unsigned int from_depth, from_index;
+      if (not s->enclosing->resolve(name, from_depth, from_index))
+        return false;
+      Scope *from = s->enclosing.get();
+      for (unsigned int i = 0; i < from_depth; i++)
+        from = from->outer.get();
+      if (from->unboxed[from_index])
+        from->escaped = true;
+      index = s->bind(name);
+      s->captures.push_back({from_depth, from_index});
+      return true;
+    }
+  }
+  return false;
+}
+
+// as resolve(), without capturing the variable
+bool Scope::is_local(const std::string &name) {
+  for (Scope *s = this; s != nullptr;
+       s = s->enclosing != nullptr ? s->enclosing.get() : s->outer.get())
+    for (auto &entry : s->visible)
+      if (entry.first == name)
+        return true;
+  return false;
+}
+
+// HELPERS
+
+/*
+ * the globals referenced by code analyzed since the last report_unresolved()
+ * that were not bound at the time, with the environment they are looked up in.
+ * */
+static vector<std::pair<shared_ptr<Environment>, shared_ptr<Symbol>>>
+    unresolved;
+
+// nonzero while code already analyzed once is analyzed again
+static unsigned int quiet = 0;
+
+static void warn(const std::string &message) {
+  if (quiet == 0)
+    std::cerr << "warning: " << message << std::endl;
+}
+
+static bool pending() { return Runtime::unhandled_exc->type != NIL; }
+
+/*
+ * called when an exception is pending: aborts as the evaluator does if nobody
+ * is catching, otherwise hands the exception back up to the enclosing try*.
+ * */
+static shared_ptr<Object> raise() {
+  check_exc();
+  return Runtime::unhandled_exc;
+}
+
+static bool truthy(const shared_ptr<Object> &o) {
+  return not((o->type == BOOL and to_bool(o)->value() == false) or
+             o->type == NIL);
+}
+
+static bool is_special(const std::string &name) {
+  return std::find(keywords.begin(), keywords.end(), name) != keywords.end();
+}
+
+static Compiled constant(shared_ptr<Object> value) {
+  return [value](const shared_ptr<Environment> &) { return value; };
+}
+
+/*
+ * a Numeric computes a number without boxing it: it stores the number in *out*
+ * and returns nullptr, or returns the value as an object when it has no number
+ * to give (another type, an exception, a generic call that may still return a
+ * Number).
+ * */
+using Numeric = std::function<shared_ptr<Object>(
+    const shared_ptr<Environment> &, double &)>;
+
+static Numeric analyze_numeric(shared_ptr<Object> ast, shared_ptr<Scope> scope);
+
+static Compiled syntax_error(std::string message) {
+  return constant(Runtime::ret_exception(message));
+}
+
+/*
+ * macro expansion is done here, once, instead of at every evaluation. a
+ * symbol bound as local shadows any macro with the same name.
+ * */
+static shared_ptr<Object> expand(shared_ptr<Object> ast,
+                                 shared_ptr<Scope> scope) {
+  while (ast->type == LIST and not to_list(ast)->elements.empty() and
+         to_list(ast)->elements[0]->type == SYMBOL) {
+    shared_ptr<Symbol> head = to_symbol(to_list(ast)->elements[0]);
+    if (is_special(head->value()) or scope->is_local(head->value()))
+      break;
+    shared_ptr<Environment> found = scope->env->find(head);
+    if (found->type != ENVIRONMENT)
+      break;
+    shared_ptr<Object> mf = found->get(head);
+    if (mf->type != FUNCTION or not mf->is_macro)
+      break;
+    shared_ptr<List> args = list();
+    for (unsigned int i = 1; i < to_list(ast)->elements.size(); i++)
+      args->append(to_list(ast)->elements[i]);
+    ast = to_function(mf)->call(args);
+  }
+  return ast;
+}
+
+/*
+ * state shared by the evaluations of a fast path or of a folded call of a
+ * builtin: the function the symbol
+ * was bound to when the code was analyzed and whether it is still bound to it
+ * as of the version *checked* of its cell, or of the environment epoch when
+ * the code does not run in the global environment. the binding of a sealed
+ * name cannot change.
+ * */
+struct Guard {
+  shared_ptr<Environment> env;
+  shared_ptr<Symbol> sym;
+  shared_ptr<Function> bound;
+  Cell *cell = nullptr;
+  unsigned long checked = 0;
+  bool valid = true;
+  bool sealed = false;
+
+  bool holds() {
+    if (sealed)
+      return true;
+    unsigned long version = cell != nullptr ? cell->version : Environment::epoch;
+    if (checked != version) {
+      valid = env->find(sym)->type == ENVIRONMENT and env->get(sym) == bound;
+      checked = version;
+    }
+    return valid;
+  }
+};
+
+static shared_ptr<Guard> guard_of(shared_ptr<Scope> scope,
+                                  shared_ptr<Symbol> sym,
+                                  shared_ptr<Function> bound) {
+  shared_ptr<Guard> guard = make_shared<Guard>(Guard{scope->env, sym, bound});
+  if (scope->env->find(sym)->is_sealed(sym->value()))
+    guard->sealed = true;
+  else if (scope->env->outer()->type != ENVIRONMENT) {
+    guard->cell = scope->env->cell(sym->value());
+    guard->checked = guard->cell->version;
+  } else
+    guard->checked = Environment::epoch;
+  return guard;
+}
+
+// nonzero while the code run when a folded value no longer holds is analyzed
+static unsigned int unfolded = 0;
+
+/*
+ * whether the pure builtin *name* handles *args*: a builtin is only called by
+ * fold() on arguments it accepts, so that its complaints about the others are
+ * left to runtime, if the call is ever evaluated.
+ * */
+static bool accepts(const std::string &name,
+                    const vector<shared_ptr<Object>> &args) {
+  auto all = [&](std::initializer_list<OBJECT_TYPE> types) {
+    for (auto &arg : args)
+      if (std::find(types.begin(), types.end(), arg->type) == types.end())
+        return false;
+    return true;
+  };
+  if (name == "+" or name == "*" or name == "-" or name == "/")
+    return not args.empty() and all({NUMBER});
+  if (name == "<" or name == ">" or name == "<=" or name == ">=")
+    return args.size() == 2 and all({NUMBER});
+  if (name == "=")
+    return args.size() == 2;
+  if (name == "str" or name == "pr-str")
+    return not args.empty();
+  if (name == "list")
+    return true;
+  if (name == "concat")
+    return all({LIST, VEC});
+  if (name == "vec")
+    return args.size() == 1 and all({LIST, VEC});
+  if (name == "keyword" or name == "symbol")
+    return args.size() == 1 and all({STRING});
+  if (name == "get")
+    return args.size() == 2 and args[0]->type == DICT;
+  // the predicates
+  return args.size() == 1;
+}
+
+/*
+ * evaluates at analysis time the forms whose value cannot change: literals,
+ * quoted forms, vectors and maps of constants and calls of pure builtins with
+ * constant arguments. the result is built once and shared by every evaluation.
+ * a builtin that can still be rebound adds its guard to *guards*: the value
+ * holds as long as they do.
+ * */
+static bool fold(shared_ptr<Object> ast, shared_ptr<Scope> scope,
+                 shared_ptr<Object> &value, vector<shared_ptr<Guard>> &guards) {
+  switch (ast->type) {
+  case NUMBER:
+  case STRING:
+  case KEYWORD:
+  case BOOL:
+  case NIL:
+    value = ast;
+    return true;
+  case SYMBOL: {
+    shared_ptr<Symbol> sym = to_symbol(ast);
+    if ((sym->value() == "nil" or sym->value() == "true" or
+         sym->value() == "false") and
+        not scope->is_local(sym->value()) and
+        scope->env->find(sym)->type == ENVIRONMENT) {
+      value = scope->env->get(sym);
+      return true;
+    }
+    return false;
+  }
+  case VEC: {
+    shared_ptr<Vec> ret = vec();
+    for (auto el : to_vec(ast)->elements) {
+      shared_ptr<Object> v;
+      if (not fold(el, scope, v, guards))
+        return false;
+      ret->append(v);
+    }
+    value = ret;
+    return true;
+  }
+  case DICT: {
+    shared_ptr<Dict> ret = dict();
+    for (auto el : to_dict(ast)->map) {
+      shared_ptr<Object> v;
+      // a key Dict::append rejects is reported when the map is evaluated
+      if ((el.first->type != KEYWORD and el.first->type != STRING) or
+          not fold(el.second, scope, v, guards))
+        return false;
+      ret->append(el.first, v);
+    }
+    value = ret;
+    return true;
+  }
+  case LIST: {
+    shared_ptr<List> form = to_list(ast);
+    if (form->elements.empty() or form->elements[0]->type != SYMBOL)
+      return false;
+    shared_ptr<Symbol> head = to_symbol(form->elements[0]);
+    if (head->value() == "quote" and form->elements.size() == 2) {
+      value = form->elements[1];
+      return true;
+    }
+    if (unfolded > 0 or is_special(head->value()) or
+        scope->is_local(head->value()) or
+        scope->env->find(head)->type != ENVIRONMENT)
+      return false;
+    shared_ptr<Object> f = scope->env->get(head);
+    if (f->type != FUNCTION or not to_function(f)->pure)
+      return false;
+    shared_ptr<List> args = list();
+    for (unsigned int i = 1; i < form->elements.size(); i++) {
+      shared_ptr<Object> v;
+      if (not fold(form->elements[i], scope, v, guards))
+        return false;
+      args->append(v);
+    }
+    if (not accepts(to_function(f)->name, args->elements))
+      return false;
+    /*
+     * a call that fails is left to runtime, where the error is reported
+     * only if the call is actually evaluated.
+     * */
+    shared_ptr<Object> saved = Runtime::unhandled_exc;
+    shared_ptr<Object> ret = to_function(f)->call(args);
+    bool failed = pending() or ret->type == NIL or ret->type == EXCEPTION;
+    Runtime::unhandled_exc = saved;
+    if (failed)
+      return false;
+    shared_ptr<Guard> guard = guard_of(scope, head, to_function(f));
+    if (not guard->sealed)
+      guards.push_back(guard);
+    value = ret;
+    return true;
+  }
+  default:
+    return false;
+  }
+}
+
+// DESTRUCTURING
+
+/*
+ * one load of a destructuring binding: the part of the value in slot *from*
+ * stored in slot *to*. a missing key takes the value of *otherwise*, if set.
+ * */
+struct Load {
+  enum { ELEMENT, REST, KEY, WHOLE } kind = ELEMENT;
+  unsigned int from = 0;
+  unsigned int index = 0;
+  shared_ptr<Object> key = nullptr;
+  Compiled otherwise = nullptr;
+  unsigned int to = 0;
+};
+
+static bool destructure(shared_ptr<Object> pattern, unsigned int from,
+                        shared_ptr<Scope> scope, vector<Load> &loads,
+                        unsigned int &bound);
+
+// stores the part *load* reads in a symbol, or destructures it further
+static bool bind_part(shared_ptr<Object> target, Load load,
+                      shared_ptr<Scope> scope, vector<Load> &loads,
+                      unsigned int &bound) {
+  if (target->type == SYMBOL) {
+    load.to = scope->bind(to_symbol(target)->value());
+    bound++;
+    loads.push_back(load);
+    return true;
+  }
+  if (target->type != VEC and target->type != DICT)
+    return false;
+  load.to = scope->bind("");
+  bound++;
+  loads.push_back(load);
+  return destructure(target, load.to, scope, loads, bound);
+}
+
+/*
+ * [a b & rest :as all] binds elements by position, {a :a :keys [b] :or {b 0}
+ * :as all} binds the values of keys; patterns nest. the symbols are bound in
+ * *scope* as the loads are planned, *bound* counts the slots taken.
+ * */
+static bool destructure(shared_ptr<Object> pattern, unsigned int from,
+                        shared_ptr<Scope> scope, vector<Load> &loads,
+                        unsigned int &bound) {
+  if (pattern->type == VEC) {
+    vector<shared_ptr<Object>> &elements = to_vec(pattern)->elements;
+    for (unsigned int i = 0, index = 0; i < elements.size(); i++) {
+      shared_ptr<Object> el = elements[i];
+      bool rest = el->type == SYMBOL and to_symbol(el)->value() == "&";
+      bool as = el->type == KEYWORD and to_keyword(el)->value() == ":as";
+      if ((rest or as) and i + 1 == elements.size())
+        return false;
+      if (rest or as) {
+        Load load = {rest ? Load::REST : Load::WHOLE, from, index};
+        if (not bind_part(elements[++i], load, scope, loads, bound))
+          return false;
+      } else if (not bind_part(el, {Load::ELEMENT, from, index++}, scope,
+                               loads, bound))
+        return false;
+    }
+    return true;
+  }
+  if (pattern->type != DICT)
+    return false;
+  shared_ptr<Dict> defaults;
+  for (auto &entry : to_dict(pattern)->map)
+    if (entry.first->type == KEYWORD and
+        to_keyword(entry.first)->value() == ":or") {
+      if (entry.second->type != DICT)
+        return false;
+      defaults = to_dict(entry.second);
+    }
+  // the load of *key* into *target*, with its default from :or
+  auto keyed = [&](shared_ptr<Object> target, shared_ptr<Object> key) {
+    Load load = {Load::KEY, from, 0, key};
+    if (defaults != nullptr and target->type == SYMBOL)
+      for (auto &d : defaults->map)
+        if (d.first->type == SYMBOL and
+            to_symbol(d.first)->value() == to_symbol(target)->value())
+          load.otherwise = analyze(d.second, scope);
+    return bind_part(target, load, scope, loads, bound);
+  };
+  for (auto &entry : to_dict(pattern)->map) {
+    if (entry.first->type == KEYWORD) {
+      const std::string &option = to_keyword(entry.first)->value();
+      if (option == ":or")
+        continue;
+      if (option == ":as") {
+        if (not bind_part(entry.second, {Load::WHOLE, from}, scope, loads,
+                          bound))
+          return false;
+        continue;
+      }
+      if (option != ":keys" or entry.second->type != VEC)
+        return false;
+      for (auto &name : to_vec(entry.second)->elements)
+        if (name->type != SYMBOL or
+            not keyed(name, keyword(":" + to_symbol(name)->value())))
+          return false;
+    } else if (not keyed(entry.first, entry.second))
+      return false;
+  }
+  return true;
+}
+
+static void load_parts(const vector<Load> &loads,
+                       const shared_ptr<Environment> &e) {
+  for (auto &load : loads) {
+    const shared_ptr<Object> &from = e->slots[load.from];
+    shared_ptr<Object> value = nil();
+    if (load.kind == Load::WHOLE)
+      value = from;
+    else if (load.kind == Load::KEY) {
+      bool found = false;
+      if (from->type == DICT) {
+        auto entry = to_dict(from)->map.find(load.key);
+        if (entry != to_dict(from)->map.end()) {
+          value = entry->second;
+          found = true;
+        }
+      }
+      if (not found and load.otherwise)
+        value = load.otherwise(e);
+    } else if (from->type == LIST or from->type == VEC) {
+      const vector<shared_ptr<Object>> &elements =
+          from->type == LIST ? to_list(from)->elements
+                             : to_vec(from)->elements;
+      if (load.kind == Load::ELEMENT) {
+        if (load.index < elements.size())
+          value = elements[load.index];
+      } else {
+        shared_ptr<List> rest = list();
+        for (unsigned int i = load.index; i < elements.size(); i++)
+          rest->append(elements[i]);
+        value = rest;
+      }
+    }
+    e->slots[load.to] = value;
+  }
+}
+
+bool uses_destructuring(shared_ptr<List> form) {
+  if (form->elements.size() < 2 or
+      (form->elements[1]->type != LIST and form->elements[1]->type != VEC))
+    return false;
+  vector<shared_ptr<Object>> &elements =
+      form->elements[1]->type == LIST ? to_list(form->elements[1])->elements
+                                      : to_vec(form->elements[1])->elements;
+  unsigned int step = form->elements[0]->type == SYMBOL and
+                              to_symbol(form->elements[0])->value() == "let*"
+                          ? 2
+                          : 1;
+  for (unsigned int i = 0; i < elements.size(); i += step)
+    if (elements[i]->type == VEC or elements[i]->type == DICT)
+      return true;
+  return false;
+}
+
+// the parameters of a fn*: symbols, or vectors and maps to destructure
+static shared_ptr<List> parameters(shared_ptr<Object> params) {
+  shared_ptr<List> ret = list();
+  if (params->type == LIST)
+    ret->elements = to_list(params)->elements;
+  else if (params->type == VEC)
+    ret->elements = to_vec(params)->elements;
+  else
+    return nullptr;
+  for (auto el : ret->elements)
+    if (el->type != SYMBOL and el->type != VEC and el->type != DICT)
+      return nullptr;
+  return ret;
+}
+
+static const shared_ptr<Object> recur_signal = signal(RECUR);
+// returned by the recur of a specialised loop whose values are no longer all
+// numbers, the loop variables have been boxed back into their slots
+static const shared_ptr<Object> deopt_signal = signal(DEOPT);
+
+/*
+ * evaluates *body* again as long as it ends with a recur, which has already
+ * stored the new values in the slots of the loop.
+ * */
+static Compiled repeat(Compiled body) {
+  return [body](const shared_ptr<Environment> &e) {
+    shared_ptr<Object> ret;
+    while ((ret = body(e)) == recur_signal)
+      ;
+    return ret;
+  };
+}
+
+static bool compile(shared_ptr<Function> f, shared_ptr<Scope> scope) {
+  scope->target = make_shared<RecurTarget>();
+  for (auto el : f->arguments->elements)
+    scope->target->slots.push_back(
+        scope->bind(el->type == SYMBOL ? to_symbol(el)->value() : ""));
+  // parameters to destructure are loaded into their parts on entry
+  vector<Load> loads;
+  unsigned int bound = 0;
+  for (unsigned int i = 0; i < f->arguments->elements.size(); i++)
+    if (f->arguments->elements[i]->type != SYMBOL and
+        not destructure(f->arguments->elements[i], scope->target->slots[i],
+                        scope, loads, bound))
+      return false;
+  shared_ptr<Code> code = make_shared<Code>();
+  code->body = analyze(f->expression, scope, true);
+  if (not loads.empty()) {
+    Compiled body = code->body;
+    code->body = [loads, body](const shared_ptr<Environment> &e) {
+      load_parts(loads, e);
+      return body(e);
+    };
+  }
+  if (scope->target->used)
+    code->body = repeat(code->body);
+  code->frame_size = scope->size;
+  f->code = code;
+  return true;
+}
+
+// SPECIAL FORMS
+
+bool is_multi_arity(shared_ptr<List> form) {
+  if (form->elements.size() < 2)
+    return false;
+  for (unsigned int i = 1; i < form->elements.size(); i++)
+    if (form->elements[i]->type != LIST or
+        to_list(form->elements[i])->elements.empty() or
+        (to_list(form->elements[i])->elements[0]->type != LIST and
+         to_list(form->elements[i])->elements[0]->type != VEC))
+      return false;
+  return true;
+}
+
+// the slot *index* of the frame *depth* levels up from *e*
+static shared_ptr<Object> slot_at(const shared_ptr<Environment> &e,
+                                  unsigned int depth, unsigned int index) {
+  Environment *frame = e.get();
+  for (unsigned int i = 0; i < depth; i++)
+    frame = frame->outer().get();
+  return frame->slots[index];
+}
+
+// the depth and index of each variable a closure captures, in capture order
+typedef vector<std::pair<unsigned int, unsigned int>> Captures;
+
+// the scope of the variables a fn* analyzed in *scope* captures
+static shared_ptr<Scope> captures_of(shared_ptr<Scope> scope) {
+  shared_ptr<Scope> captured = make_shared<Scope>(nullptr, scope->env);
+  captured->enclosing = scope;
+  return captured;
+}
+
+/*
+ * the body is analyzed once, when the fn* is; every evaluation of the fn*
+ * only copies the prototype, sharing its Code, and attaches the values it
+ * captures. the calling environment of the new function holds the captured
+ * values only, hanging from the environment of the free symbols. a function
+ * bound by let* to the local in slot *self* captures itself there, as that
+ * slot is only stored once the function exists.
+ * */
+static Compiled instantiate(shared_ptr<Function> proto,
+                            shared_ptr<Scope> captured, int self) {
+  shared_ptr<Environment> env = captured->env;
+  Captures captures = captured->captures;
+  if (captures.empty())
+    return [proto, env](const shared_ptr<Environment> &) {
+      shared_ptr<Function> f = make_shared<Function>(*proto);
+      f->calling_env = env;
+      return to_obj(f);
+    };
+  return [proto, env, captures, self](const shared_ptr<Environment> &e) {
+    shared_ptr<Function> f = make_shared<Function>(*proto);
+    shared_ptr<Environment> closure =
+        make_shared<Environment>(env, captures.size());
+    for (unsigned int i = 0; i < captures.size(); i++)
+      if (captures[i].first == 0 and (int)captures[i].second == self)
+        closure->slots[i] = f;
+      else
+        closure->slots[i] = slot_at(e, captures[i].first, captures[i].second);
+    f->calling_env = closure;
+    return to_obj(f);
+  };
+}
+
+/*
+ * (fn* ([params] body) ...): every clause is analyzed as a function of its
+ * own and put in the dispatch table of the prototype, so that a call picks
+ * the clause by the number of arguments without going through a rest list.
+ * */
+static Compiled analyze_arities(shared_ptr<List> form,
+                                shared_ptr<Scope> scope, int self,
+                                Captures *captures) {
+  shared_ptr<Function> proto = func(list(), nil(), scope->env, "");
+  shared_ptr<Code> code = make_shared<Code>();
+  shared_ptr<Scope> captured = captures_of(scope);
+  for (unsigned int i = 1; i < form->elements.size(); i++) {
+    shared_ptr<List> clause = to_list(form->elements[i]);
+    if (clause->elements.size() != 2)
+      return syntax_error(
+          "fn* clauses must be a list of the parameters and the body");
+    shared_ptr<List> params = parameters(clause->elements[0]);
+    if (params == nullptr)
+      return syntax_error(
+        "fn* parameters must be symbols or destructuring patterns");
+    shared_ptr<Function> f = func(params, clause->elements[1], scope->env, "");
+    if (not compile(f, make_shared<Scope>(captured, scope->env)))
+      return syntax_error("fn*: invalid destructuring pattern");
+    if (f->last_is_variadic >= 0) {
+      if (code->variadic != nullptr)
+        return syntax_error("fn* can have only one variadic clause");
+      code->variadic = f;
+      continue;
+    }
+    unsigned int count = f->arguments->elements.size();
+    if (count >= code->arities.size())
+      code->arities.resize(count + 1);
+    if (code->arities[count] != nullptr)
+      return syntax_error("fn* has two clauses taking " +
+                          std::to_string(count) + " arguments");
+    code->arities[count] = f;
+  }
+  if (code->variadic != nullptr and
+      (int)code->arities.size() > code->variadic->last_is_variadic + 1)
+    return syntax_error("fn* clauses cannot take more arguments than the "
+                        "variadic one");
+  proto->code = code;
+  if (captures != nullptr)
+    *captures = captured->captures;
+  return instantiate(proto, captured, self);
+}
+
+static Compiled analyze_fn(shared_ptr<List> form, shared_ptr<Scope> scope,
+                           int self = -1, Captures *captures = nullptr) {
+  if (is_multi_arity(form))
+    return analyze_arities(form, scope, self, captures);
+  if (form->elements.size() != 3)
+    return syntax_error(
+        "fn* arguments must be a list of the parameters and the body");
+  shared_ptr<List> params = parameters(form->elements[1]);
+  if (params == nullptr)
+    return syntax_error(
+        "fn* parameters must be symbols or destructuring patterns");
+  shared_ptr<Function> proto = func(params, form->elements[2], scope->env, "");
+  shared_ptr<Scope> captured = captures_of(scope);
+  if (not compile(proto, make_shared<Scope>(captured, scope->env)))
+    return syntax_error("fn*: invalid destructuring pattern");
+  if (captures != nullptr)
+    *captures = captured->captures;
+  return instantiate(proto, captured, self);
+}
+
+// whether the let* binding of *name* to *value* is a (fn* ...)
+static bool binds_fn(shared_ptr<Object> name, shared_ptr<Object> value,
+                     shared_ptr<Scope> scope) {
+  return name->type == SYMBOL and value->type == LIST and
+         not to_list(value)->elements.empty() and
+         to_list(value)->elements[0]->type == SYMBOL and
+         to_symbol(to_list(value)->elements[0])->value() == "fn*" and
+         not scope->is_local("fn*");
+}
+
+static Compiled analyze_let(shared_ptr<List> form, shared_ptr<Scope> scope,
+                            bool tail) {
+  if (form->elements.size() != 3)
+    return syntax_error("let* used with the wrong number of arguments");
+  vector<shared_ptr<Object>> bindings;
+  if (form->elements[1]->type == LIST)
+    bindings = to_list(form->elements[1])->elements;
+  else if (form->elements[1]->type == VEC)
+    bindings = to_vec(form->elements[1])->elements;
+  else
+    return syntax_error("let* need a list or vector as first parameter");
+  if (bindings.size() % 2 != 0)
+    return syntax_error("number of new environment entries myst be fair");
+
+  /*
+   * the fn* bound to a name see the names of every fn* of the let*, so that
+   * they can call each other: their slots are bound first and named while a
+   * fn* is analyzed, the other values only see the names bound before them.
+   * a fn* bound before one it captures has that capture stored once the later
+   * function exists. a name bound twice keeps the order of the bindings.
+   * */
+  vector<int> early(bindings.size() / 2, -1);
+  for (unsigned int i = 0; i < bindings.size(); i += 2)
+    if (binds_fn(bindings[i], bindings[i + 1], scope) and
+        std::count_if(bindings.begin(), bindings.end(),
+                      [&](const shared_ptr<Object> &b) {
+                        return b->type == SYMBOL and
+                               to_symbol(b)->value() ==
+                                   to_symbol(bindings[i])->value();
+                      }) == 1)
+      early[i / 2] = scope->bind("");
+
+  // the slot of every value and the loads destructuring it
+  vector<std::pair<unsigned int, Compiled>> values;
+  vector<vector<Load>> parts;
+  // for every value, the captures of the functions before it it is stored in,
+  // as the slot of the function and the index of the capture
+  vector<vector<std::pair<unsigned int, unsigned int>>> later(early.size());
+  unsigned int bound = 0;
+  for (unsigned int i = 0; i < bindings.size(); i += 2) {
+    parts.push_back({});
+    if (early[i / 2] >= 0) {
+      unsigned int index = early[i / 2];
+      for (unsigned int j = i / 2; j < early.size(); j++)
+        if (early[j] >= 0)
+          scope->rename(early[j], to_symbol(bindings[2 * j])->value());
+      Captures captures;
+      values.push_back({index, analyze_fn(to_list(bindings[i + 1]), scope,
+                                          index, &captures)});
+      for (unsigned int j = i / 2 + 1; j < early.size(); j++)
+        if (early[j] >= 0) {
+          scope->rename(early[j], "");
+          for (unsigned int k = 0; k < captures.size(); k++)
+            if (captures[k].first == 0 and
+                captures[k].second == (unsigned int)early[j])
+              later[j].push_back({index, k});
+        }
+      continue;
+    }
+    // a fn* sees its own name, to call itself
+    if (binds_fn(bindings[i], bindings[i + 1], scope)) {
+      unsigned int index = scope->bind(to_symbol(bindings[i])->value());
+      values.push_back({index, analyze_fn(to_list(bindings[i + 1]), scope,
+                                          index)});
+      continue;
+    }
+    Compiled value = analyze(bindings[i + 1], scope);
+    if (bindings[i]->type == SYMBOL)
+      values.push_back({scope->bind(to_symbol(bindings[i])->value()), value});
+    else {
+      values.push_back({scope->bind(""), value});
+      if (not destructure(bindings[i], values.back().first, scope,
+                          parts.back(), bound)) {
+        scope->unbind(values.size() + bound);
+        return syntax_error(
+            "let*: new key entries must be symbols or destructuring patterns");
+      }
+    }
+  }
+  Compiled body = analyze(form->elements[2], scope, tail);
+  scope->unbind(values.size() + bound);
+  return [values, parts, later, body](const shared_ptr<Environment> &e) {
+    for (unsigned int i = 0; i < values.size(); i++) {
+      e->slots[values[i].first] = values[i].second(e);
+      if (not parts[i].empty())
+        load_parts(parts[i], e);
+      for (auto &[slot, capture] : later[i])
+        to_function(e->slots[slot])->calling_env->slots[capture] =
+            e->slots[values[i].first];
+    }
+    return body(e);
+  };
+}
+
+/*
+ * (cond test expr ...) as a chain of ifs: the first truthy test selects its
+ * expression, nil if none does.
+ * */
+static Compiled analyze_cond(shared_ptr<List> form, shared_ptr<Scope> scope,
+                             bool tail) {
+  if (form->elements.size() % 2 == 0)
+    return syntax_error("odd number of forms to cond");
+  Compiled ret = constant(nil());
+  for (int i = form->elements.size() - 2; i >= 1; i -= 2) {
+    Compiled test = analyze(form->elements[i], scope);
+    Compiled expr = analyze(form->elements[i + 1], scope, tail);
+    ret = [test, expr, ret](const shared_ptr<Environment> &e) {
+      if (truthy(test(e)))
+        return expr(e);
+      return ret(e);
+    };
+  }
+  return ret;
+}
+
+/*
+ * (and ...) returns the first falsy value and (or ...) the first truthy one,
+ * without evaluating the rest; otherwise the last value, or the value of the
+ * empty form.
+ * */
+static Compiled analyze_logic(shared_ptr<List> form, shared_ptr<Scope> scope,
+                              bool tail, bool is_and) {
+  if (form->elements.size() == 1)
+    return constant(is_and ? to_obj(boolean(true)) : to_obj(nil()));
+  vector<Compiled> forms;
+  for (unsigned int i = 1; i < form->elements.size() - 1; i++)
+    forms.push_back(analyze(form->elements[i], scope));
+  Compiled last = analyze(form->elements.back(), scope, tail);
+  return [forms, last, is_and](const shared_ptr<Environment> &e) {
+    for (auto &f : forms) {
+      shared_ptr<Object> ret = f(e);
+      if (pending())
+        return raise();
+      if (truthy(ret) != is_and)
+        return ret;
+    }
+    return last(e);
+  };
+}
+
+/*
+ * the forms of *form* from *from* on, evaluated in order as an implicit do.
+ * */
+static Compiled analyze_body(shared_ptr<List> form, unsigned int from,
+                             shared_ptr<Scope> scope, bool tail) {
+  vector<Compiled> forms;
+  for (unsigned int i = from; i < form->elements.size(); i++)
+    forms.push_back(analyze(form->elements[i], scope,
+                            tail and i == form->elements.size() - 1));
+  if (forms.empty())
+    return constant(nil());
+  if (forms.size() == 1)
+    return forms[0];
+  return [forms](const shared_ptr<Environment> &e) {
+    for (unsigned int i = 0; i < forms.size() - 1; i++)
+      forms[i](e);
+    return forms.back()(e);
+  };
+}
+
+static Compiled analyze_do(shared_ptr<List> form, shared_ptr<Scope> scope,
+                           bool tail) {
+  if (form->elements.size() < 2)
+    return syntax_error("do expression must be called with a list argument");
+  return analyze_body(form, 1, scope, tail);
+}
+
+static Compiled analyze_when(shared_ptr<List> form, shared_ptr<Scope> scope,
+                             bool tail) {
+  if (form->elements.size() < 2)
+    return syntax_error("when needs a condition");
+  Compiled condition = analyze(form->elements[1], scope);
+  Compiled body = analyze_body(form, 2, scope, tail);
+  return [condition, body](const shared_ptr<Environment> &e) {
+    if (truthy(condition(e)))
+      return body(e);
+    return to_obj(nil());
+  };
+}
+
+static Compiled analyze_def(shared_ptr<List> form, shared_ptr<Scope> scope,
+                            bool is_macro) {
+  if (form->elements.size() != 3)
+    return syntax_error("def! used with the wrong number of arguments");
+  if (form->elements[1]->type != SYMBOL)
+    return syntax_error("def! accept only symbol as key");
+  shared_ptr<Object> key = form->elements[1];
+  shared_ptr<Environment> env = scope->env;
+  Compiled value = analyze(form->elements[2], scope);
+  return [key, env, value, is_macro](const shared_ptr<Environment> &e) {
+    shared_ptr<Object> v = value(e);
+    if (pending())
+      return raise();
+    if (is_macro)
+      v->is_macro = true;
+    env->set(key, v);
+    if (pending())
+      return raise();
+    return v;
+  };
+}
+
+// LOOPS
+
+static bool bindings_of(shared_ptr<Object> o, vector<shared_ptr<Object>> &out) {
+  if (o->type == LIST)
+    out = to_list(o)->elements;
+  else if (o->type == VEC)
+    out = to_vec(o)->elements;
+  else
+    return false;
+  return true;
+}
+
+/*
+ * whether the initial value *ast* of a loop variable looks like a number: a
+ * literal, an arithmetic call or an unboxed variable. only such variables are
+ * unboxed by the specialised body of the loop.
+ * */
+static bool numeric_init(shared_ptr<Object> ast, shared_ptr<Scope> scope) {
+  unsigned int depth, index;
+  if (ast->type == NUMBER)
+    return true;
+  if (ast->type == SYMBOL)
+    return scope->is_local(to_symbol(ast)->value()) and
+           scope->resolve(to_symbol(ast)->value(), depth, index) and
+           depth == 0 and scope->unboxed[index];
+  if (ast->type != LIST or to_list(ast)->elements.empty() or
+      to_list(ast)->elements[0]->type != SYMBOL)
+    return false;
+  const std::string &head = to_symbol(to_list(ast)->elements[0])->value();
+  return head == "+" or head == "-" or head == "*" or head == "/";
+}
+
+/*
+ * the body of an innermost loop is analyzed twice: as usual, and specialised
+ * with the variables that start as numbers unboxed in Environment::numbers,
+ * where arithmetic reads and updates them without allocating. the specialised
+ * body runs as long as those variables hold numbers: a recur giving one of
+ * them anything else boxes them all back and the loop goes on in the generic
+ * body, which it then keeps using.
+ * */
+struct LoopFeedback {
+  bool deoptimized = false;
+};
+
+// the loops analyzed so far: a loop containing another one is not specialised,
+// its body would be analyzed twice at every level of nesting
+static unsigned int loops = 0;
+
+static Compiled analyze_loop(shared_ptr<List> form, shared_ptr<Scope> scope) {
+  vector<shared_ptr<Object>> bindings;
+  if (form->elements.size() < 3 or
+      not bindings_of(form->elements[1], bindings) or
+      bindings.size() % 2 != 0)
+    return syntax_error("loop: syntax error. it must be (loop [NAME VALUE ...] "
+                        "BODY)");
+  shared_ptr<RecurTarget> target = make_shared<RecurTarget>();
+  target->loop = true;
+  vector<Compiled> inits;
+  vector<unsigned int> numeric;
+  for (unsigned int i = 0; i < bindings.size(); i += 2) {
+    if (bindings[i]->type != SYMBOL)
+      return syntax_error("loop: new key entries must be symbols");
+    inits.push_back(analyze(bindings[i + 1], scope));
+    if (numeric_init(bindings[i + 1], scope))
+      numeric.push_back(i / 2);
+    target->slots.push_back(scope->bind(to_symbol(bindings[i])->value()));
+  }
+  shared_ptr<RecurTarget> outer_target = scope->target;
+  scope->target = target;
+  unsigned int analyzed = ++loops;
+  Compiled body = repeat(analyze_body(form, 2, scope, true));
+
+  Compiled special;
+  if (not numeric.empty() and loops == analyzed) {
+    scope->target = make_shared<RecurTarget>(*target);
+    for (unsigned int i : numeric)
+      scope->unboxed[target->slots[i]] = true;
+    bool escaped = scope->escaped;
+    scope->escaped = false;
+    quiet++;
+    special = analyze_body(form, 2, scope, true);
+    quiet--;
+    if (scope->escaped)
+      special = nullptr;
+    scope->escaped = escaped or scope->escaped;
+    for (unsigned int i : numeric)
+      scope->unboxed[target->slots[i]] = false;
+  }
+  scope->target = outer_target;
+  scope->unbind(target->slots.size());
+
+  vector<unsigned int> slots = target->slots;
+  if (special == nullptr)
+    return [inits, slots, body](const shared_ptr<Environment> &e) {
+      for (unsigned int i = 0; i < inits.size(); i++)
+        e->slots[slots[i]] = inits[i](e);
+      return body(e);
+    };
+
+  unsigned int size = scope->size;
+  shared_ptr<LoopFeedback> feedback = make_shared<LoopFeedback>();
+  return [inits, slots, body, special, numeric, size,
+          feedback](const shared_ptr<Environment> &e) {
+    for (unsigned int i = 0; i < inits.size(); i++)
+      e->slots[slots[i]] = inits[i](e);
+    if (feedback->deoptimized)
+      return body(e);
+    for (unsigned int i : numeric)
+      if (e->slots[slots[i]]->type != NUMBER)
+        return body(e);
+    if (e->numbers.size() < size)
+      e->numbers.resize(size);
+    for (unsigned int i : numeric)
+      e->numbers[slots[i]] = to_number(e->slots[slots[i]])->value();
+    shared_ptr<Object> ret;
+    while ((ret = special(e)) == recur_signal)
+      ;
+    if (ret != deopt_signal)
+      return ret;
+    feedback->deoptimized = true;
+    return body(e);
+  };
+}
+
+/*
+ * the new values are first evaluated into scratch slots, so that every value
+ * still sees the old bindings, and then moved into the slots of the loop. in
+ * the specialised body of a loop the unboxed variables take their values from
+ * scratch numbers, unless one of them is not a number.
+ * */
+static Compiled analyze_recur(shared_ptr<List> form, shared_ptr<Scope> scope,
+                              bool tail) {
+  if (not tail or scope->target == nullptr)
+    return syntax_error("recur: can only be used in tail position of a loop "
+                        "or a fn*");
+  shared_ptr<RecurTarget> target = scope->target;
+  if (form->elements.size() - 1 != target->slots.size())
+    return syntax_error("recur: expected " +
+                        std::to_string(target->slots.size()) + " values, got " +
+                        std::to_string(form->elements.size() - 1));
+  target->used = true;
+  vector<unsigned int> scratch;
+  for (unsigned int i = 0; i < target->slots.size(); i++)
+    scratch.push_back(scope->bind(""));
+  vector<Compiled> values;
+  vector<Numeric> numbers;
+  bool specialised = false;
+  for (unsigned int i = 1; i < form->elements.size(); i++) {
+    if (scope->unboxed[target->slots[i - 1]]) {
+      numbers.push_back(analyze_numeric(form->elements[i], scope));
+      values.push_back(nullptr);
+      specialised = true;
+    } else {
+      numbers.push_back(nullptr);
+      values.push_back(analyze(form->elements[i], scope));
+    }
+  }
+  scope->unbind(scratch.size());
+
+  vector<unsigned int> slots = target->slots;
+  if (not specialised)
+    return [values, scratch, slots](const shared_ptr<Environment> &e) {
+      for (unsigned int i = 0; i < values.size(); i++)
+        e->slots[scratch[i]] = values[i](e);
+      if (pending())
+        return raise();
+      for (unsigned int i = 0; i < slots.size(); i++)
+        e->slots[slots[i]] = std::move(e->slots[scratch[i]]);
+      return recur_signal;
+    };
+
+  return [values, numbers, scratch, slots](const shared_ptr<Environment> &e) {
+    bool deopt = false;
+    for (unsigned int i = 0; i < values.size(); i++)
+      if (numbers[i] != nullptr) {
+        double value = 0;
+        shared_ptr<Object> ret = numbers[i](e, value);
+        if (ret != nullptr and ret->type == NUMBER) {
+          value = to_number(ret)->value();
+          ret = nullptr;
+        }
+        e->numbers[scratch[i]] = value;
+        deopt = deopt or ret != nullptr;
+        e->slots[scratch[i]] = ret;
+      } else
+        e->slots[scratch[i]] = values[i](e);
+    if (pending())
+      return raise();
+    for (unsigned int i = 0; i < slots.size(); i++)
+      if (numbers[i] == nullptr)
+        e->slots[slots[i]] = std::move(e->slots[scratch[i]]);
+      else if (not deopt)
+        e->numbers[slots[i]] = e->numbers[scratch[i]];
+      else if (e->slots[scratch[i]] != nullptr)
+        e->slots[slots[i]] = std::move(e->slots[scratch[i]]);
+      else
+        e->slots[slots[i]] = number(e->numbers[scratch[i]]);
+    return deopt ? deopt_signal : recur_signal;
+  };
+}
+
+/*
+ * (dotimes [i n] BODY) and (doseq [x coll] BODY) iterate natively, rebinding
+ * the slot of the variable at every step like a loop does. the counter of a
+ * dotimes is kept unboxed in Environment::numbers, unless a closure of the
+ * body captures it.
+ * */
+static Compiled analyze_iteration(shared_ptr<List> form,
+                                  shared_ptr<Scope> scope, bool over_seq) {
+  std::string name = over_seq ? "doseq" : "dotimes";
+  vector<shared_ptr<Object>> binding;
+  if (form->elements.size() < 3 or
+      not bindings_of(form->elements[1], binding) or binding.size() != 2 or
+      binding[0]->type != SYMBOL)
+    return syntax_error(name + ": syntax error. it must be (" + name +
+                        " [NAME VALUE] BODY)");
+  Compiled value = analyze(binding[1], scope);
+  unsigned int slot = scope->bind(to_symbol(binding[0])->value());
+  shared_ptr<RecurTarget> outer_target = scope->target;
+  scope->target = nullptr;
+  bool unboxed = not over_seq;
+  Compiled body;
+  if (unboxed) {
+    scope->unboxed[slot] = true;
+    bool escaped = scope->escaped;
+    scope->escaped = false;
+    body = analyze_body(form, 2, scope, false);
+    unboxed = not scope->escaped;
+    scope->escaped = escaped or scope->escaped;
+    scope->unboxed[slot] = false;
+  }
+  if (not unboxed) {
+    quiet += not over_seq;
+    body = analyze_body(form, 2, scope, false);
+    quiet -= not over_seq;
+  }
+  scope->target = outer_target;
+  scope->unbind(1);
+
+  if (over_seq)
+    return [value, slot, body](const shared_ptr<Environment> &e) {
+      shared_ptr<Object> coll = value(e);
+      if (pending())
+        return raise();
+      const vector<shared_ptr<Object>> *elements;
+      if (coll->type == LIST)
+        elements = &to_list(coll)->elements;
+      else if (coll->type == VEC)
+        elements = &to_vec(coll)->elements;
+      else if (coll->type == NIL)
+        return to_obj(nil());
+      else
+        return to_obj(
+            Runtime::ret_exception("doseq: only list or vec can be iterated"));
+      for (unsigned int i = 0; i < elements->size(); i++) {
+        e->slots[slot] = (*elements)[i];
+        body(e);
+        if (pending())
+          return raise();
+      }
+      return to_obj(nil());
+    };
+  unsigned int size = scope->size;
+  return [value, slot, body, unboxed,
+          size](const shared_ptr<Environment> &e) {
+    shared_ptr<Object> n = value(e);
+    if (pending())
+      return raise();
+    if (n->type != NUMBER)
+      return to_obj(Runtime::ret_exception("dotimes: count must be a number"));
+    if (unboxed and e->numbers.size() < size)
+      e->numbers.resize(size);
+    for (double i = 0; i < to_number(n)->value(); i++) {
+      // a closure capturing the counter keeps the value of its step
+      if (unboxed)
+        e->numbers[slot] = i;
+      else
+        e->slots[slot] = number(i);
+      body(e);
+      if (pending())
+        return raise();
+    }
+    return to_obj(nil());
+  };
+}
+
+static Compiled analyze_try(shared_ptr<List> form, shared_ptr<Scope> scope) {
+  if (not(form->elements.size() == 3 and form->elements[2]->type == LIST and
+          to_list(form->elements[2])->elements.size() == 3 and
+          to_list(form->elements[2])->elements[0]->type == SYMBOL and
+          to_list(form->elements[2])->elements[1]->type == SYMBOL and
+          to_symbol(to_list(form->elements[2])->elements[0])->value() ==
+              "catch*"))
+    return syntax_error("try*/catch*: syntax error. it must be (try* CODE "
+                        "(catch* error ERROR_HANDLE_CODE))");
+  shared_ptr<List> catch_form = to_list(form->elements[2]);
+  Compiled body = analyze(form->elements[1], scope);
+  unsigned int slot = scope->bind(to_symbol(catch_form->elements[1])->value());
+  Compiled handler = analyze(catch_form->elements[2], scope);
+  scope->unbind(1);
+  return [body, slot, handler](const shared_ptr<Environment> &e) {
+    bool was_catching = catching;
+    catching = true;
+    shared_ptr<Object> ret = body(e);
+    catching = was_catching;
+    if (ret->type == EXCEPTION or pending()) {
+      e->slots[slot] = pending() ? Runtime::unhandled_exc : ret;
+      Runtime::unhandled_exc = nil();
+      return handler(e);
+    }
+    return ret;
+  };
+}
+
+// QUASIQUOTE
+
+// the argument of *o* if it is a (*name* argument) form, nullptr otherwise
+static shared_ptr<Object> unquoted(const shared_ptr<Object> &o,
+                                   const std::string &name) {
+  if (o->type == LIST and to_list(o)->elements.size() == 2 and
+      to_list(o)->elements[0]->type == SYMBOL and
+      to_symbol(to_list(o)->elements[0])->value() == name)
+    return to_list(o)->elements[1];
+  return nullptr;
+}
+
+bool has_unquote(const shared_ptr<Object> &o) {
+  if (o->type != LIST and o->type != VEC)
+    return false;
+  if (unquoted(o, "unquote") or unquoted(o, "splice-unquote"))
+    return true;
+  for (auto &el : o->type == LIST ? to_list(o)->elements : to_vec(o)->elements)
+    if (has_unquote(el))
+      return true;
+  return false;
+}
+
+/*
+ * a quasiquote template becomes a construction plan instead of the cons and
+ * concat calls quasiquote() expands it to: the parts without unquote are
+ * shared constants, and every list or vector with unquotes is built in one
+ * pass, splicing the values of splice-unquote into it.
+ * */
+static Compiled analyze_quasiquote(shared_ptr<Object> ast,
+                                   shared_ptr<Scope> scope) {
+  if (not has_unquote(ast))
+    return constant(ast);
+  shared_ptr<Object> value = unquoted(ast, "unquote");
+  if (value != nullptr)
+    return analyze(value, scope);
+
+  // an element of the template and whether it is spliced
+  vector<std::pair<Compiled, bool>> parts;
+  for (auto &el :
+       ast->type == LIST ? to_list(ast)->elements : to_vec(ast)->elements) {
+    shared_ptr<Object> spliced = unquoted(el, "splice-unquote");
+    if (spliced != nullptr)
+      parts.push_back({analyze(spliced, scope), true});
+    else
+      parts.push_back({analyze_quasiquote(el, scope), false});
+  }
+  bool is_vec = ast->type == VEC;
+  return [parts, is_vec](const shared_ptr<Environment> &e) -> shared_ptr<Object> {
+    vector<shared_ptr<Object>> elements;
+    elements.reserve(parts.size());
+    for (auto &part : parts) {
+      shared_ptr<Object> value = part.first(e);
+      if (pending())
+        return raise();
+      if (not part.second)
+        elements.push_back(value);
+      else if (value->type == LIST)
+        elements.insert(elements.end(), to_list(value)->elements.begin(),
+                        to_list(value)->elements.end());
+      else if (value->type == VEC)
+        elements.insert(elements.end(), to_vec(value)->elements.begin(),
+                        to_vec(value)->elements.end());
+      else
+        return Runtime::ret_exception(
+            "splice-unquote: the value must be a list or a vector");
+    }
+    if (is_vec) {
+      shared_ptr<Vec> ret = vec();
+      ret->elements = std::move(elements);
+      return ret;
+    }
+    shared_ptr<List> ret = list();
+    ret->elements = std::move(elements);
+    return ret;
+  };
+}
+
+// MATCH
+
+/*
+ * (match expr pattern body ...) is compiled into a decision tree. patterns are
+ * flattened into tests on parts of the matched value, a part being an element
+ * or a map value reached from another part and kept in a slot of its own. the
+ * tree always makes the next test of the first clause still possible: clauses
+ * sharing the test drop it on success, clauses it rules out are dropped, and
+ * the literals tested on the same part become one hash lookup.
+ * */
+enum TEST { IS_LIST, IS_VEC, IS_DICT, HAS_KEY, LITERAL };
+
+struct Part {
+  int parent; // -1 for the matched value
+  unsigned int index;
+  bool rest; // the elements from index on, as a list
+  shared_ptr<Object> key;
+  unsigned int slot;
+  // parts loaded once this one passes a list or vector test
+  vector<unsigned int> elements;
+};
+
+struct Test {
+  TEST kind = LITERAL;
+  unsigned int part = 0;
+  unsigned int length = 0;
+  bool at_least = false;
+  shared_ptr<Object> value = nullptr;
+};
+
+struct Clause {
+  vector<Test> tests;
+  vector<std::pair<unsigned int, unsigned int>> bindings; // part, slot
+  Compiled body;
+};
+
+struct Row {
+  shared_ptr<Clause> clause;
+  vector<Test> tests;
+};
+
+static bool is_literal_symbol(const std::string &name) {
+  return name == "nil" or name == "true" or name == "false";
+}
+
+static shared_ptr<Object> literal_value(shared_ptr<Object> o) {
+  if (o->type == SYMBOL and to_symbol(o)->value() == "nil")
+    return nil();
+  if (o->type == SYMBOL and is_literal_symbol(to_symbol(o)->value()))
+    return boolean(to_symbol(o)->value() == "true");
+  return o;
+}
+
+// the hash key of a literal, false for values that cannot be one
+static bool literal_key(const shared_ptr<Object> &o, std::string &key) {
+  switch (o->type) {
+  case NUMBER: {
+    double n = to_number(o)->value();
+    if (n == 0)
+      n = 0; // -0 and 0 are the same literal
+    key = "n" + std::string((const char *)&n, sizeof(n));
+    return true;
+  }
+  case STRING:
+    key = "s" + to_str(o)->value();
+    return true;
+  case KEYWORD:
+    key = "k" + to_keyword(o)->value();
+    return true;
+  case SYMBOL:
+    key = "y" + to_symbol(o)->value();
+    return true;
+  case BOOL:
+    key = to_bool(o)->value() ? "t" : "f";
+    return true;
+  case NIL:
+    key = "z";
+    return true;
+  default:
+    return false;
+  }
+}
+
+static unsigned int part_of(vector<Part> &parts, int parent,
+                            unsigned int index, bool rest,
+                            shared_ptr<Object> key, shared_ptr<Scope> scope) {
+  for (unsigned int i = 0; i < parts.size(); i++)
+    if (parts[i].parent == parent and parts[i].rest == rest and
+        (key == nullptr ? parts[i].key == nullptr and parts[i].index == index
+                        : parts[i].key != nullptr and
+                              KeyEqual()(parts[i].key, key)))
+      return i;
+  parts.push_back({parent, index, rest, key, scope->bind(""), {}});
+  if (key == nullptr)
+    parts[parent].elements.push_back(parts.size() - 1);
+  return parts.size() - 1;
+}
+
+// flattens *pattern* matched against *part* into the tests of *clause*
+static bool flatten_pattern(shared_ptr<Object> pattern, unsigned int part,
+                            vector<Part> &parts, Clause &clause,
+                            vector<std::pair<std::string, unsigned int>> &names,
+                            shared_ptr<Scope> scope) {
+  pattern = literal_value(pattern);
+  if (pattern->type == SYMBOL) {
+    if (to_symbol(pattern)->value() != "_")
+      names.push_back({to_symbol(pattern)->value(), part});
+    return true;
+  }
+  if (pattern->type == LIST and to_list(pattern)->elements.size() == 2 and
+      to_list(pattern)->elements[0]->type == SYMBOL and
+      to_symbol(to_list(pattern)->elements[0])->value() == "quote")
+    pattern = to_list(pattern)->elements[1];
+  else if (pattern->type == LIST or pattern->type == VEC) {
+    vector<shared_ptr<Object>> elements = pattern->type == LIST
+                                              ? to_list(pattern)->elements
+                                              : to_vec(pattern)->elements;
+    Test shape = {pattern->type == LIST ? IS_LIST : IS_VEC, part};
+    shape.length = elements.size();
+    for (unsigned int i = 0; i < elements.size(); i++)
+      if (elements[i]->type == SYMBOL and
+          to_symbol(elements[i])->value() == "&") {
+        if (i != elements.size() - 2)
+          return false;
+        shape.length = i;
+        shape.at_least = true;
+      }
+    clause.tests.push_back(shape);
+    for (unsigned int i = 0; i < shape.length; i++)
+      if (not flatten_pattern(elements[i],
+                              part_of(parts, part, i, false, nullptr, scope),
+                              parts, clause, names, scope))
+        return false;
+    if (shape.at_least)
+      return flatten_pattern(
+          elements.back(),
+          part_of(parts, part, shape.length, true, nullptr, scope), parts,
+          clause, names, scope);
+    return true;
+  } else if (pattern->type == DICT) {
+    clause.tests.push_back({IS_DICT, part});
+    for (auto &entry : to_dict(pattern)->map) {
+      std::string key;
+      if (not literal_key(entry.first, key))
+        return false;
+      unsigned int value = part_of(parts, part, 0, false, entry.first, scope);
+      clause.tests.push_back({HAS_KEY, value});
+      if (not flatten_pattern(entry.second, value, parts, clause, names,
+                              scope))
+        return false;
+    }
+    return true;
+  }
+  std::string key;
+  if (not literal_key(pattern, key))
+    return false;
+  Test literal = {LITERAL, part};
+  literal.value = pattern;
+  clause.tests.push_back(literal);
+  return true;
+}
+
+static bool same_test(const Test &a, const Test &b) {
+  return a.kind == b.kind and a.part == b.part and a.length == b.length and
+         a.at_least == b.at_least and a.kind != LITERAL;
+}
+
+// whether *b* must fail on the part *a* has succeeded on
+static bool rules_out(const Test &a, const Test &b) {
+  if (a.part != b.part or a.kind == HAS_KEY or b.kind == HAS_KEY)
+    return false;
+  if (a.kind != b.kind)
+    return true;
+  if (a.kind == IS_DICT)
+    return false;
+  if (not a.at_least and not b.at_least)
+    return a.length != b.length;
+  if (not a.at_least)
+    return a.length < b.length;
+  if (not b.at_least)
+    return b.length < a.length;
+  return false;
+}
+
+static shared_ptr<Object> load(const Part &part, const vector<Part> &parts,
+                               const shared_ptr<Environment> &e) {
+  const shared_ptr<Object> &from = e->slots[parts[part.parent].slot];
+  const vector<shared_ptr<Object>> &elements =
+      from->type == LIST ? to_list(from)->elements : to_vec(from)->elements;
+  if (not part.rest)
+    return elements[part.index];
+  shared_ptr<List> rest = list();
+  for (unsigned int i = part.index; i < elements.size(); i++)
+    rest->append(elements[i]);
+  return rest;
+}
+
+static Compiled decide(const vector<Row> &rows,
+                       shared_ptr<vector<Part>> parts) {
+  if (rows.empty())
+    return constant(nil());
+  if (rows[0].tests.empty()) {
+    shared_ptr<Clause> clause = rows[0].clause;
+    return [clause, parts](const shared_ptr<Environment> &e) {
+      for (auto &binding : clause->bindings)
+        e->slots[binding.second] = e->slots[(*parts)[binding.first].slot];
+      return clause->body(e);
+    };
+  }
+  const Test test = rows[0].tests[0];
+  unsigned int slot = (*parts)[test.part].slot;
+
+  if (test.kind == LITERAL) {
+    // every literal tested on the part, in the order of the clauses
+    vector<std::string> keys;
+    std::unordered_map<std::string, vector<Row>> cases;
+    vector<Row> others;
+    for (auto &row : rows) {
+      auto found = std::find_if(row.tests.begin(), row.tests.end(),
+                                [&](const Test &t) {
+                                  return t.kind == LITERAL and
+                                         t.part == test.part;
+                                });
+      if (found == row.tests.end()) {
+        others.push_back(row);
+        for (auto &key : keys)
+          cases[key].push_back(row);
+        continue;
+      }
+      std::string key;
+      literal_key(found->value, key);
+      if (not cases.contains(key)) {
+        keys.push_back(key);
+        cases[key] = others;
+      }
+      Row rest = row;
+      rest.tests.erase(rest.tests.begin() + (found - row.tests.begin()));
+      cases[key].push_back(rest);
+    }
+    std::unordered_map<std::string, Compiled> table;
+    for (auto &key : keys)
+      table[key] = decide(cases[key], parts);
+    Compiled otherwise = decide(others, parts);
+    return [slot, table, otherwise](const shared_ptr<Environment> &e) {
+      std::string key;
+      if (literal_key(e->slots[slot], key)) {
+        auto found = table.find(key);
+        if (found != table.end())
+          return found->second(e);
+      }
+      return otherwise(e);
+    };
+  }
+
+  vector<Row> yes, no;
+  for (auto &row : rows) {
+    auto same = std::find_if(row.tests.begin(), row.tests.end(),
+                             [&](const Test &t) { return same_test(test, t); });
+    if (same != row.tests.end()) {
+      Row rest = row;
+      rest.tests.erase(rest.tests.begin() + (same - row.tests.begin()));
+      yes.push_back(rest);
+      continue;
+    }
+    no.push_back(row);
+    if (std::none_of(row.tests.begin(), row.tests.end(),
+                     [&](const Test &t) { return rules_out(test, t); }))
+      yes.push_back(row);
+  }
+  Compiled then_branch = decide(yes, parts), else_branch = decide(no, parts);
+
+  if (test.kind == HAS_KEY) {
+    unsigned int from = (*parts)[(*parts)[test.part].parent].slot;
+    shared_ptr<Object> key = (*parts)[test.part].key;
+    return [slot, from, key, then_branch,
+            else_branch](const shared_ptr<Environment> &e) {
+      const shared_ptr<Dict> &from_dict = to_dict(e->slots[from]);
+      auto entry = from_dict->map.find(key);
+      if (entry == from_dict->map.end())
+        return else_branch(e);
+      e->slots[slot] = entry->second;
+      return then_branch(e);
+    };
+  }
+  OBJECT_TYPE type =
+      test.kind == IS_LIST ? LIST : test.kind == IS_VEC ? VEC : DICT;
+  unsigned int length = test.length;
+  bool at_least = test.at_least;
+  vector<unsigned int> elements = (*parts)[test.part].elements;
+  return [slot, type, length, at_least, elements, parts, then_branch,
+          else_branch](const shared_ptr<Environment> &e) {
+    const shared_ptr<Object> &value = e->slots[slot];
+    if (value->type != type)
+      return else_branch(e);
+    if (type != DICT) {
+      unsigned int size = type == LIST ? to_list(value)->elements.size()
+                                       : to_vec(value)->elements.size();
+      if (size < length or (not at_least and size != length))
+        return else_branch(e);
+      for (auto part : elements)
+        if ((*parts)[part].index < size or (*parts)[part].rest)
+          e->slots[(*parts)[part].slot] = load((*parts)[part], *parts, e);
+    }
+    return then_branch(e);
+  };
+}
+
+static Compiled analyze_match(shared_ptr<List> form, shared_ptr<Scope> scope,
+                              bool tail) {
+  if (form->elements.size() < 2 or form->elements.size() % 2 != 0)
+    return syntax_error("match needs a value and pairs of pattern and body");
+  Compiled value = analyze(form->elements[1], scope);
+  auto parts = make_shared<vector<Part>>();
+  parts->push_back({-1, 0, false, nullptr, scope->bind(""), {}});
+  unsigned int reserved = 1;
+
+  vector<shared_ptr<Clause>> clauses;
+  vector<vector<std::pair<std::string, unsigned int>>> names;
+  for (unsigned int i = 2; i < form->elements.size(); i += 2) {
+    clauses.push_back(make_shared<Clause>());
+    names.push_back({});
+    unsigned int before = parts->size();
+    bool valid = flatten_pattern(form->elements[i], 0, *parts,
+                                 *clauses.back(), names.back(), scope);
+    reserved += parts->size() - before;
+    if (not valid) {
+      scope->unbind(reserved);
+      return syntax_error("match: invalid pattern");
+    }
+  }
+  /*
+   * the slots of the parts stay reserved while the bodies are analyzed, the
+   * variables of a clause get slots after them.
+   * */
+  vector<Row> rows;
+  for (unsigned int i = 0; i < clauses.size(); i++) {
+    for (auto &name : names[i])
+      clauses[i]->bindings.push_back({name.second, scope->bind(name.first)});
+    clauses[i]->body = analyze(form->elements[2 * i + 3], scope, tail);
+    scope->unbind(names[i].size());
+    rows.push_back({clauses[i], clauses[i]->tests});
+  }
+  scope->unbind(reserved);
+
+  Compiled tree = decide(rows, parts);
+  unsigned int slot = (*parts)[0].slot;
+  return [value, slot, tree](const shared_ptr<Environment> &e) {
+    e->slots[slot] = value(e);
+    if (pending())
+      return raise();
+    return tree(e);
+  };
+}
+
+// APPLY / INVOKE
+
+/*
+ * the clause of the analyzed function *f* a call with *count* arguments runs
+ * and the number of its fixed parameters, nullptr if none takes them.
+ * */
+static Function *clause_for(shared_ptr<Function> f, unsigned int count,
+                            unsigned int &fixed) {
+  Function *clause = f->dispatch(count);
+  if (clause == nullptr)
+    return nullptr;
+  fixed = clause->last_is_variadic >= 0 ? clause->last_is_variadic
+                                        : clause->arguments->elements.size();
+  if (count < fixed or (clause->last_is_variadic < 0 and count != fixed))
+    return nullptr;
+  return clause;
+}
+
+/*
+ * the callee a call site was last proven correct for: while the head keeps
+ * evaluating to it the clause is reused and the arity is not checked again.
+ * the site does not keep the callee, nor what it captures, alive: it is
+ * recognized by its control block, which the weak_ptr keeps from being
+ * reused by another function.
+ * */
+struct CallSite {
+  std::weak_ptr<Function> callee;
+  Function *clause = nullptr;
+  unsigned int fixed = 0;
+
+  bool calls(const shared_ptr<Function> &f) const {
+    return not callee.owner_before(f) and not f.owner_before(callee);
+  }
+};
+
+// the call *form* of the function *head* evaluates to, with the code of its
+// arguments already analyzed
+static Compiled call_of(shared_ptr<List> form, shared_ptr<Scope> scope,
+                        Compiled head, vector<Compiled> args, bool values) {
+  /*
+   * a global function known at analysis time is checked now: the call site
+   * starts proven, or the mismatch is reported before the code ever runs.
+   * */
+  shared_ptr<CallSite> site = make_shared<CallSite>();
+  if (form->elements[0]->type == SYMBOL) {
+    shared_ptr<Symbol> sym = to_symbol(form->elements[0]);
+    if (not scope->is_local(sym->value()) and
+        scope->env->find(sym)->type == ENVIRONMENT) {
+      shared_ptr<Object> fo = scope->env->get(sym);
+      if (fo->type == FUNCTION and not fo->is_macro) {
+        shared_ptr<Function> f = to_function(fo);
+        if (f->code != nullptr) {
+          site->clause = clause_for(f, args.size(), site->fixed);
+          if (site->clause != nullptr)
+            site->callee = f;
+          else
+            warn("wrong number of arguments in a call of " + sym->value());
+        }
+      }
+    }
+  }
+
+  return [head, args, site,
+          values](const shared_ptr<Environment> &e) -> shared_ptr<Object> {
+    shared_ptr<Object> fo = head(e);
+    if (pending())
+      return raise();
+    if (fo->type != FUNCTION)
+      return Runtime::ret_exception(
+          "invoke/apply: evaluating a list not starting with a function type");
+    shared_ptr<Function> f = to_function(fo);
+    if (f->code != nullptr) {
+      if (not site->calls(f)) {
+        unsigned int fixed = 0;
+        Function *clause = clause_for(f, args.size(), fixed);
+        if (clause == nullptr)
+          return Runtime::ret_exception(
+              "Funcion <" + f->calling_env->get_key(f) +
+              ">: wrong number of parameters");
+        site->callee = f;
+        site->clause = clause;
+        site->fixed = fixed;
+      }
+      Function *clause = site->clause;
+      unsigned int fixed = site->fixed;
+      /*
+       * the arguments are evaluated straight into the slots of the new frame,
+       * no intermediate list is built.
+       * */
+      Frame call(f->calling_env, clause->code->frame_size);
+      const shared_ptr<Environment> &frame = call.env();
+      frame->values_wanted = values;
+      for (unsigned int i = 0; i < fixed; i++)
+        frame->slots[i] = args[i](e);
+      if (clause->last_is_variadic >= 0) {
+        shared_ptr<List> varargs = list();
+        for (unsigned int i = fixed; i < args.size(); i++)
+          varargs->append(args[i](e));
+        frame->slots[fixed] = varargs;
+      }
+      if (pending())
+        return raise();
+      return clause->code->body(frame);
+    } else {
+      shared_ptr<List> arguments = list();
+      for (auto &arg : args)
+        arguments->append(arg(e));
+      if (pending())
+        return raise();
+      shared_ptr<Object> ret = f->call(arguments);
+      if (pending())
+        return raise();
+      return ret;
+    }
+  };
+}
+
+static Compiled analyze_call(shared_ptr<List> form, shared_ptr<Scope> scope,
+                             bool values = false) {
+  Compiled head = analyze(form->elements[0], scope);
+  vector<Compiled> args;
+  for (unsigned int i = 1; i < form->elements.size(); i++)
+    args.push_back(analyze(form->elements[i], scope));
+  return call_of(form, scope, head, args, values);
+}
+
+// MULTIPLE VALUES
+
+/*
+ * the values a function returns to a let-values, left there by the (values
+ * ...) in its return position, which then returns values_signal.
+ * */
+static vector<shared_ptr<Object>> values_register;
+static const shared_ptr<Object> values_signal = signal(VALUES);
+
+/*
+ * (values a b ...) in the return position of a function called by let-values
+ * hands its results over in the register, anywhere else it is a list.
+ * */
+static Compiled analyze_values(shared_ptr<List> form, shared_ptr<Scope> scope,
+                               bool tail) {
+  // the results are gathered in scratch slots first, evaluating one of them
+  // may run another let-values
+  vector<unsigned int> scratch;
+  for (unsigned int i = 1; i < form->elements.size(); i++)
+    scratch.push_back(scope->bind(""));
+  vector<Compiled> args;
+  for (unsigned int i = 1; i < form->elements.size(); i++)
+    args.push_back(analyze(form->elements[i], scope));
+  scope->unbind(scratch.size());
+  bool returning = tail and scope->target != nullptr and not scope->target->loop;
+
+  return [args, scratch,
+          returning](const shared_ptr<Environment> &e) -> shared_ptr<Object> {
+    if (not returning or not e->values_wanted) {
+      shared_ptr<List> ret = list();
+      for (auto &arg : args)
+        ret->append(arg(e));
+      if (pending())
+        return raise();
+      return ret;
+    }
+    for (unsigned int i = 0; i < args.size(); i++)
+      e->slots[scratch[i]] = args[i](e);
+    if (pending())
+      return raise();
+    values_register.resize(args.size());
+    for (unsigned int i = 0; i < args.size(); i++)
+      values_register[i] = std::move(e->slots[scratch[i]]);
+    return values_signal;
+  };
+}
+
+/*
+ * (let-values ((a b) EXPR ...) BODY) binds the names of each list to the
+ * values of its EXPR, every EXPR seeing the names bound before it. a (values
+ * ...) form is bound directly and a call takes the values from the register,
+ * a list or vector (values that went through a list) is taken apart.
+ * */
+static Compiled analyze_let_values(shared_ptr<List> form,
+                                   shared_ptr<Scope> scope, bool tail) {
+  vector<shared_ptr<Object>> bindings;
+  if (form->elements.size() < 3 or
+      not bindings_of(form->elements[1], bindings) or
+      bindings.size() % 2 != 0)
+    return syntax_error("let-values: syntax error. it must be (let-values "
+                        "((NAME ...) EXPR ...) BODY)");
+
+  struct Binding {
+    vector<unsigned int> slots;
+    // the code of each value of a (values ...) form, or of the whole EXPR
+    vector<Compiled> values;
+    Compiled expr;
+  };
+  vector<Binding> parts;
+  unsigned int bound = 0;
+  for (unsigned int i = 0; i < bindings.size(); i += 2) {
+    vector<shared_ptr<Object>> names;
+    if (not bindings_of(bindings[i], names)) {
+      scope->unbind(bound);
+      return syntax_error("let-values: the names must be in a list");
+    }
+    for (auto &name : names)
+      if (name->type != SYMBOL) {
+        scope->unbind(bound);
+        return syntax_error("let-values: the names must be symbols");
+      }
+    // the names are reserved before the EXPR is analyzed so that its own
+    // locals do not share their slots, and bound once it has been
+    for (unsigned int j = 0; j < names.size(); j++)
+      scope->bind("");
+    Binding part;
+    shared_ptr<Object> expr = expand(bindings[i + 1], scope);
+    shared_ptr<List> call = expr->type == LIST ? to_list(expr) : nullptr;
+    if (call != nullptr and not call->elements.empty() and
+        call->elements[0]->type == SYMBOL and
+        to_symbol(call->elements[0])->value() == "values" and
+        not scope->is_local("values")) {
+      if (call->elements.size() - 1 != names.size()) {
+        scope->unbind(bound + names.size());
+        return syntax_error("let-values: expected " +
+                            std::to_string(names.size()) + " values, got " +
+                            std::to_string(call->elements.size() - 1));
+      }
+      for (unsigned int j = 1; j < call->elements.size(); j++)
+        part.values.push_back(analyze(call->elements[j], scope));
+    } else if (call != nullptr and not call->elements.empty() and
+               not(call->elements[0]->type == SYMBOL and
+                   is_special(to_symbol(call->elements[0])->value())))
+      part.expr = analyze_call(call, scope, true);
+    else
+      part.expr = analyze(expr, scope);
+    scope->unbind(names.size());
+    for (auto &name : names)
+      part.slots.push_back(scope->bind(to_symbol(name)->value()));
+    bound += names.size();
+    parts.push_back(part);
+  }
+  Compiled body = analyze_body(form, 2, scope, tail);
+  scope->unbind(bound);
+
+  return [parts, body](const shared_ptr<Environment> &e) -> shared_ptr<Object> {
+    for (auto &part : parts) {
+      if (part.expr == nullptr) {
+        for (unsigned int i = 0; i < part.values.size(); i++)
+          e->slots[part.slots[i]] = part.values[i](e);
+        if (pending())
+          return raise();
+        continue;
+      }
+      shared_ptr<Object> ret = part.expr(e);
+      if (pending())
+        return raise();
+      const vector<shared_ptr<Object>> *values = nullptr;
+      if (ret == values_signal)
+        values = &values_register;
+      else if (ret->type == LIST)
+        values = &to_list(ret)->elements;
+      else if (ret->type == VEC)
+        values = &to_vec(ret)->elements;
+      if (values == nullptr or values->size() != part.slots.size()) {
+        std::string got =
+            values == nullptr ? "1" : std::to_string(values->size());
+        values_register.clear();
+        return Runtime::ret_exception("let-values: expected " +
+                                      std::to_string(part.slots.size()) +
+                                      " values, got " + got);
+      }
+      for (unsigned int i = 0; i < part.slots.size(); i++)
+        e->slots[part.slots[i]] = (*values)[i];
+      if (ret == values_signal)
+        values_register.clear();
+    }
+    return body(e);
+  };
+}
+
+// ARITHMETIC
+
+enum ARITHMETIC { ADD, SUB, MUL, DIV, LT, GT, LE, GE, EQ };
+constexpr unsigned int max_operands = 4;
+
+static shared_ptr<Object> compare(ARITHMETIC op, double a, double b) {
+  static const shared_ptr<Object> yes = boolean(true), no = boolean(false);
+  bool ret;
+  switch (op) {
+  case LT:
+    ret = a < b;
+    break;
+  case GT:
+    ret = a > b;
+    break;
+  case LE:
+    ret = a <= b;
+    break;
+  case GE:
+    ret = a >= b;
+    break;
+  default:
+    ret = a == b;
+  }
+  return ret ? yes : no;
+}
+
+/*
+ * whether *form* calls one of the core numeric builtins the fast paths know,
+ * with a number of operands they handle: its operator and a guard on it.
+ * */
+static bool arithmetic_call(shared_ptr<List> form, shared_ptr<Scope> scope,
+                            ARITHMETIC &op, shared_ptr<Guard> &guard) {
+  static const std::unordered_map<std::string, ARITHMETIC> operators = {
+      {"+", ADD}, {"-", SUB}, {"*", MUL}, {"/", DIV}, {"<", LT},
+      {">", GT},  {"<=", LE}, {">=", GE}, {"=", EQ}};
+  if (form->elements.empty() or form->elements[0]->type != SYMBOL)
+    return false;
+  shared_ptr<Symbol> sym = to_symbol(form->elements[0]);
+  auto found = operators.find(sym->value());
+  if (found == operators.end() or scope->is_local(sym->value()) or
+      scope->env->find(sym)->type != ENVIRONMENT)
+    return false;
+  shared_ptr<Object> builtin = scope->env->get(sym);
+  if (builtin->type != FUNCTION or not to_function(builtin)->compiled or
+      to_function(builtin)->name != sym->value())
+    return false;
+  op = found->second;
+  unsigned int count = form->elements.size() - 1;
+  if (count == 0 or count > max_operands or (op >= LT and count != 2))
+    return false;
+  guard = guard_of(scope, sym, to_function(builtin));
+  return true;
+}
+
+// calls *fo* on operands the fast path could not handle
+static shared_ptr<Object> slow_call(const shared_ptr<Object> &fo,
+                                    const shared_ptr<Object> *boxed,
+                                    const double *values, unsigned int count) {
+  if (pending())
+    return raise();
+  if (fo->type != FUNCTION)
+    return Runtime::ret_exception(
+        "invoke/apply: evaluating a list not starting with a function type");
+  shared_ptr<List> l = list();
+  for (unsigned int i = 0; i < count; i++)
+    l->append(boxed[i] != nullptr ? boxed[i] : number(values[i]));
+  shared_ptr<Object> ret = to_function(fo)->call(l);
+  if (pending())
+    return raise();
+  return ret;
+}
+
+// FLAT CODE
+
+/*
+ * conditionals and the numeric builtins over locals and constants are not
+ * analyzed into a tree of closures but laid out as a Program: a contiguous
+ * array of nodes referring to their children by index, with side tables for
+ * the constants, the guards and the code of the subexpressions analyzed as
+ * usual. it is built once from the macro expanded forms, which are left as
+ * they are for quote and macros, and numbers travel between its nodes unboxed.
+ * */
+struct Node {
+  enum Kind { CONSTANT, NUMBER, LOCAL, UNBOXED, IF, OPERATION, CODE } kind;
+  // the constant, slot, guard or code the node refers to
+  unsigned int index = 0;
+  // the children are Program::children[first] ... [first + count - 1]
+  unsigned int first = 0;
+  unsigned int count = 0;
+  ARITHMETIC op = ADD;
+  double number = 0;
+};
+
+struct Program {
+  vector<Node> nodes;
+  vector<unsigned int> children;
+  vector<shared_ptr<Object>> constants;
+  vector<Compiled> code;
+  // the guard on the builtin of each operation
+  vector<shared_ptr<Guard>> guards;
+
+  // runs the node *at* with the contract of a Numeric
+  shared_ptr<Object> run(unsigned int at, const shared_ptr<Environment> &e,
+                         double &out) const;
+  shared_ptr<Object> operation(const Node &node,
+                               const shared_ptr<Environment> &e,
+                               double &out) const;
+};
+
+shared_ptr<Object> Program::run(unsigned int at,
+                                const shared_ptr<Environment> &e,
+                                double &out) const {
+  const Node &node = nodes[at];
+  switch (node.kind) {
+  case Node::CONSTANT:
+    return constants[node.index];
+  case Node::NUMBER:
+    out = node.number;
+    return nullptr;
+  case Node::LOCAL:
+    return e->slots[node.index];
+  case Node::UNBOXED:
+    out = e->numbers[node.index];
+    return nullptr;
+  case Node::IF: {
+    double value;
+    shared_ptr<Object> test = run(children[node.first], e, value);
+    if (test == nullptr or truthy(test))
+      return run(children[node.first + 1], e, out);
+    return run(children[node.first + 2], e, out);
+  }
+  case Node::OPERATION:
+    return operation(node, e, out);
+  default:
+    return code[node.index](e);
+  }
+}
+
+/*
+ * + - * / and the comparisons on numbers. anything else (other types, division
+ * by zero) is handed to the builtin so errors are unchanged, and once the
+ * symbol is rebound the operands go to whatever it is bound to.
+ * */
+shared_ptr<Object> Program::operation(const Node &node,
+                                      const shared_ptr<Environment> &e,
+                                      double &out) const {
+  const shared_ptr<Guard> &guard = guards[node.index];
+  // looked up before the operands are evaluated, as a call does
+  shared_ptr<Object> rebound;
+  if (not guard->holds())
+    rebound = guard->env->get(guard->sym);
+  shared_ptr<Object> boxed[max_operands];
+  double values[max_operands];
+  bool numbers = true;
+  for (unsigned int i = 0; i < node.count; i++) {
+    const Node &operand = nodes[children[node.first + i]];
+    if (operand.kind == Node::LOCAL) {
+      // read in place, the slot keeps the object alive
+      const shared_ptr<Object> &local = e->slots[operand.index];
+      if (local->type == NUMBER)
+        values[i] = static_cast<const Number &>(*local).value();
+      else
+        boxed[i] = local;
+    } else {
+      boxed[i] = run(children[node.first + i], e, values[i]);
+      if (boxed[i] != nullptr and boxed[i]->type == NUMBER) {
+        values[i] = static_cast<const Number &>(*boxed[i]).value();
+        boxed[i] = nullptr;
+      }
+    }
+    if (boxed[i] != nullptr or (node.op == DIV and i > 0 and values[i] == 0))
+      numbers = false;
+  }
+  if (rebound != nullptr)
+    return slow_call(rebound, boxed, values, node.count);
+  if (not numbers)
+    return slow_call(guard->bound, boxed, values, node.count);
+  if (node.op >= LT)
+    return compare(node.op, values[0], values[1]);
+  double tot = values[0];
+  for (unsigned int i = 1; i < node.count; i++) {
+    switch (node.op) {
+    case ADD:
+      tot += values[i];
+      break;
+    case SUB:
+      tot -= values[i];
+      break;
+    case MUL:
+      tot *= values[i];
+      break;
+    default:
+      tot /= values[i];
+    }
+  }
+  out = tot;
+  return nullptr;
+}
+
+static unsigned int add_node(Program &program, Node node,
+                             const vector<unsigned int> &children) {
+  node.first = program.children.size();
+  node.count = children.size();
+  program.children.insert(program.children.end(), children.begin(),
+                          children.end());
+  program.nodes.push_back(node);
+  return program.nodes.size() - 1;
+}
+
+static unsigned int add_code(Program &program, Compiled code) {
+  program.code.push_back(code);
+  return add_node(program, Node{Node::CODE, (unsigned int)program.code.size() - 1},
+                  {});
+}
+
+// adds the nodes computing *ast* to *program*, returns the index of the root
+static unsigned int flatten(shared_ptr<Object> ast, shared_ptr<Scope> scope,
+                            bool tail, Program &program) {
+  unsigned int depth, index;
+  if (ast->type == SYMBOL and scope->is_local(to_symbol(ast)->value()) and
+      scope->resolve(to_symbol(ast)->value(), depth, index) and depth == 0)
+    return add_node(
+        program, Node{scope->unboxed[index] ? Node::UNBOXED : Node::LOCAL, index},
+        {});
+  shared_ptr<Object> value;
+  vector<shared_ptr<Guard>> guards;
+  if (fold(ast, scope, value, guards) and guards.empty()) {
+    Node node{Node::CONSTANT};
+    if (value->type == NUMBER) {
+      node.kind = Node::NUMBER;
+      node.number = to_number(value)->value();
+    } else {
+      node.index = program.constants.size();
+      program.constants.push_back(value);
+    }
+    return add_node(program, node, {});
+  }
+  if (ast->type != LIST)
+    return add_code(program, analyze(ast, scope, tail));
+  ast = expand(ast, scope);
+  if (ast->type != LIST)
+    return flatten(ast, scope, tail, program);
+  shared_ptr<List> form = to_list(ast);
+  if (form->elements.empty())
+    return add_code(program, analyze(ast, scope, tail));
+
+  if (form->elements[0]->type == SYMBOL and
+      to_symbol(form->elements[0])->value() == "if") {
+    if (form->elements.size() != 3 and form->elements.size() != 4)
+      return add_code(program,
+                      syntax_error("if used with the wrong number of arguments"));
+    vector<unsigned int> children;
+    children.push_back(flatten(form->elements[1], scope, false, program));
+    children.push_back(flatten(form->elements[2], scope, tail, program));
+    children.push_back(form->elements.size() == 4
+                           ? flatten(form->elements[3], scope, tail, program)
+                           : flatten(nil(), scope, tail, program));
+    return add_node(program, Node{Node::IF}, children);
+  }
+
+  ARITHMETIC op;
+  shared_ptr<Guard> guard;
+  if (arithmetic_call(form, scope, op, guard)) {
+    Node node{Node::OPERATION, (unsigned int)program.guards.size()};
+    node.op = op;
+    program.guards.push_back(guard);
+    vector<unsigned int> children;
+    for (unsigned int i = 1; i < form->elements.size(); i++)
+      children.push_back(flatten(form->elements[i], scope, false, program));
+    return add_node(program, node, children);
+  }
+  return add_code(program, analyze(ast, scope, tail));
+}
+
+// the flat program of an if or of a call of a numeric builtin
+static Compiled analyze_flat(shared_ptr<Object> ast, shared_ptr<Scope> scope,
+                             bool tail) {
+  shared_ptr<Program> program = make_shared<Program>();
+  unsigned int root = flatten(ast, scope, tail, *program);
+  return [program, root](const shared_ptr<Environment> &e) {
+    double value;
+    shared_ptr<Object> ret = program->run(root, e, value);
+    return ret != nullptr ? ret : number(value);
+  };
+}
+
+static Numeric analyze_numeric(shared_ptr<Object> ast,
+                               shared_ptr<Scope> scope) {
+  shared_ptr<Program> program = make_shared<Program>();
+  unsigned int root = flatten(ast, scope, false, *program);
+  return [program, root](const shared_ptr<Environment> &e, double &out) {
+    return program->run(root, e, out);
+  };
+}
+
+// INLINING
+
+constexpr unsigned int max_inline_size = 16;
+
+/*
+ * whether *ast*, the body of the function *self*, can be analyzed in place of
+ * a call: it may not refer to *self*, create closures, recur or define, nor
+ * use a name the caller has a local for, other than the parameters. *size*
+ * counts its nodes.
+ * */
+static bool inlinable(shared_ptr<Object> ast, const std::string &self,
+                      shared_ptr<List> params, shared_ptr<Scope> scope,
+                      unsigned int &size) {
+  if (++size > max_inline_size)
+    return false;
+  switch (ast->type) {
+  case SYMBOL: {
+    const std::string &name = to_symbol(ast)->value();
+    if (name == self)
+      return false;
+    for (auto &param : params->elements)
+      if (to_symbol(param)->value() == name)
+        return true;
+    return not scope->is_local(name);
+  }
+  case LIST:
+  case VEC: {
+    vector<shared_ptr<Object>> &elements =
+        ast->type == LIST ? to_list(ast)->elements : to_vec(ast)->elements;
+    if (ast->type == LIST and not elements.empty() and
+        elements[0]->type == SYMBOL) {
+      const std::string &head = to_symbol(elements[0])->value();
+      if (head == "quote")
+        return true;
+      if (is_special(head) and head != "if" and head != "do" and
+          head != "let*" and head != "cond" and head != "and" and
+          head != "or" and head != "when")
+        return false;
+    }
+    for (auto &el : elements)
+      if (not inlinable(el, self, params, scope, size))
+        return false;
+    return true;
+  }
+  case DICT:
+    for (auto &el : to_dict(ast)->map)
+      if (not inlinable(el.second, self, params, scope, size))
+        return false;
+    return true;
+  default:
+    return true;
+  }
+}
+
+/*
+ * a call of a small global function is replaced by its body, analyzed in the
+ * frame of the caller with the parameters in slots of their own. the inlined
+ * body is used as long as the symbol is still bound to the same function,
+ * after a def! of it the call is made as usual. returns an empty Compiled if
+ * the call cannot be inlined.
+ * */
+static Compiled analyze_inline(shared_ptr<List> form, shared_ptr<Scope> scope) {
+  // the functions being inlined, against indirect recursion
+  static vector<Function *> inlining;
+  shared_ptr<Symbol> sym = to_symbol(form->elements[0]);
+  if (scope->is_local(sym->value()) or
+      scope->env->find(sym)->type != ENVIRONMENT)
+    return nullptr;
+  shared_ptr<Object> fo = scope->env->get(sym);
+  if (fo->type != FUNCTION or fo->is_macro)
+    return nullptr;
+  shared_ptr<Function> f = to_function(fo);
+  unsigned int count = form->elements.size() - 1;
+  if (f->compiled or f->code == nullptr or f->multi_arity() or
+      f->last_is_variadic >= 0 or f->calling_env != scope->env or
+      f->arguments->elements.size() != count or count > max_operands or
+      std::find(inlining.begin(), inlining.end(), f.get()) != inlining.end())
+    return nullptr;
+  for (auto &param : f->arguments->elements)
+    if (param->type != SYMBOL)
+      return nullptr;
+  unsigned int size = 0;
+  if (not inlinable(f->expression, sym->value(), f->arguments, scope, size))
+    return nullptr;
+
+  shared_ptr<Guard> guard = guard_of(scope, sym, f);
+  /*
+   * the arguments are analyzed once and shared with the generic call: a copy
+   * of their closures in each would double the code at every nested call.
+   * */
+  shared_ptr<vector<Compiled>> args = make_shared<vector<Compiled>>();
+  for (unsigned int i = 1; i < form->elements.size(); i++)
+    args->push_back(analyze(form->elements[i], scope));
+  vector<Compiled> shared;
+  for (unsigned int i = 0; i < args->size(); i++)
+    shared.push_back([args, i](const shared_ptr<Environment> &e) {
+      return (*args)[i](e);
+    });
+  Compiled generic = call_of(form, scope, analyze(sym, scope), shared, false);
+  vector<unsigned int> slots;
+  for (auto &param : f->arguments->elements)
+    slots.push_back(scope->bind(to_symbol(param)->value()));
+  inlining.push_back(f.get());
+  Compiled body = analyze(f->expression, scope);
+  inlining.pop_back();
+  scope->unbind(slots.size());
+
+  return [guard, generic, args, slots,
+          body](const shared_ptr<Environment> &e) -> shared_ptr<Object> {
+    if (not guard->holds())
+      return generic(e);
+    // all the arguments are evaluated before any parameter slot is written,
+    // their own locals may use the same slots
+    shared_ptr<Object> values[max_operands];
+    for (unsigned int i = 0; i < args->size(); i++)
+      values[i] = (*args)[i](e);
+    if (pending())
+      return raise();
+    for (unsigned int i = 0; i < slots.size(); i++)
+      e->slots[slots[i]] = std::move(values[i]);
+    return body(e);
+  };
+}
+
+// ANALYZE
+
+Compiled analyze(shared_ptr<Object> ast, shared_ptr<Scope> scope, bool tail) {
+  shared_ptr<Object> value;
+  vector<shared_ptr<Guard>> guards;
+  if ((ast->type == SYMBOL or ast->type == LIST or ast->type == VEC or
+       ast->type == DICT) and
+      fold(ast, scope, value, guards)) {
+    if (guards.empty())
+      return constant(value);
+    // once a builtin folded is rebound, the form is evaluated as written
+    unfolded++;
+    quiet++;
+    Compiled generic = analyze(ast, scope, tail);
+    quiet--;
+    unfolded--;
+    return [guards, value, generic](const shared_ptr<Environment> &e) {
+      for (auto &guard : guards)
+        if (not guard->holds())
+          return generic(e);
+      return value;
+    };
+  }
+
+  switch (ast->type) {
+  case SYMBOL: {
+    shared_ptr<Symbol> sym = to_symbol(ast);
+    unsigned int depth, index;
+    if (scope->resolve(sym->value(), depth, index)) {
+      if (depth == 0 and scope->unboxed[index])
+        return [index](const shared_ptr<Environment> &e) {
+          return number(e->numbers[index]);
+        };
+      if (depth == 0)
+        return [index](const shared_ptr<Environment> &e) {
+          return e->slots[index];
+        };
+      return [depth, index](const shared_ptr<Environment> &e) {
+        return slot_at(e, depth, index);
+      };
+    }
+    if (is_special(sym->value()))
+      return constant(ast);
+    shared_ptr<Environment> env = scope->env;
+    shared_ptr<Environment> owner = env->find(sym);
+    if (owner->type != ENVIRONMENT)
+      unresolved.push_back({env, sym});
+    else if (owner->is_sealed(sym->value()))
+      return constant(owner->get(sym));
+    /*
+     * in the global environment nothing can come to shadow the binding, the
+     * symbol is read from its cell. a name not bound yet is declared so that
+     * the def! that binds it later fills the same cell.
+     * */
+    if (env->outer()->type != ENVIRONMENT) {
+      Cell *cell = env->cell(sym->value());
+      return [env, cell, sym](const shared_ptr<Environment> &) {
+        return cell->value != nullptr ? cell->value : env->get(sym);
+      };
+    }
+    return [env, sym](const shared_ptr<Environment> &) {
+      return env->get(sym);
+    };
+  }
+  case VEC: {
+    vector<Compiled> elements;
+    for (auto el : to_vec(ast)->elements)
+      elements.push_back(analyze(el, scope));
+    return [elements](const shared_ptr<Environment> &e) {
+      shared_ptr<Vec> ret = vec();
+      ret->elements.reserve(elements.size());
+      for (auto &el : elements)
+        ret->append(el(e));
+      return to_obj(ret);
+    };
+  }
+  case DICT: {
+    vector<std::pair<shared_ptr<Object>, Compiled>> entries;
+    for (auto el : to_dict(ast)->map)
+      entries.push_back({el.first, analyze(el.second, scope)});
+    return [entries](const shared_ptr<Environment> &e) {
+      shared_ptr<Dict> ret = dict();
+      for (auto &el : entries)
+        ret->append(el.first, el.second(e));
+      if (pending())
+        return raise();
+      return to_obj(ret);
+    };
+  }
+  case LIST:
+    break;
+  default:
+    return constant(ast);
+  }
+
+  ast = expand(ast, scope);
+  if (ast->type != LIST)
+    return analyze(ast, scope, tail);
+  shared_ptr<List> form = to_list(ast);
+  if (form->elements.empty())
+    return constant(ast);
+
+  if (form->elements[0]->type == SYMBOL) {
+    const std::string &name = to_symbol(form->elements[0])->value();
+    if (name == "fn*")
+      return analyze_fn(form, scope);
+    else if (name == "let*")
+      return analyze_let(form, scope, tail);
+    else if (name == "if")
+      return analyze_flat(form, scope, tail);
+    else if (name == "do")
+      return analyze_do(form, scope, tail);
+    else if (name == "cond")
+      return analyze_cond(form, scope, tail);
+    else if (name == "and" or name == "or")
+      return analyze_logic(form, scope, tail, name == "and");
+    else if (name == "when")
+      return analyze_when(form, scope, tail);
+    else if (name == "match")
+      return analyze_match(form, scope, tail);
+    else if (name == "values")
+      return analyze_values(form, scope, tail);
+    else if (name == "let-values")
+      return analyze_let_values(form, scope, tail);
+    else if (name == "loop")
+      return analyze_loop(form, scope);
+    else if (name == "recur")
+      return analyze_recur(form, scope, tail);
+    else if (name == "dotimes")
+      return analyze_iteration(form, scope, false);
+    else if (name == "doseq")
+      return analyze_iteration(form, scope, true);
+    else if (name == "def!")
+      return analyze_def(form, scope, false);
+    else if (name == "defmacro!")
+      return analyze_def(form, scope, true);
+    else if (name == "try*")
+      return analyze_try(form, scope);
+    else if (name == "quote") {
+      if (form->elements.size() != 2)
+        return syntax_error("quote: accept one argument");
+      return constant(form->elements[1]);
+    } else if (name == "quasiquote") {
+      if (form->elements.size() != 2)
+        return syntax_error("quasiquote take one parameter");
+      return analyze_quasiquote(form->elements[1], scope);
+    } else if (name == "quasiquoteexpand") {
+      if (form->elements.size() != 2)
+        return syntax_error("quasiquoteexpand take one parameter");
+      return constant(quasiquote(form->elements[1]));
+    } else if (name == "macroexpand") {
+      if (form->elements.size() != 2)
+        return syntax_error("macroexpand: this function take one paramenter");
+      shared_ptr<Object> expr = form->elements[1];
+      shared_ptr<Environment> env = scope->env;
+      return [expr, env](const shared_ptr<Environment> &) {
+        return macroexpand(expr, env);
+      };
+    }
+  }
+  if (form->elements[0]->type == SYMBOL) {
+    ARITHMETIC op;
+    shared_ptr<Guard> guard;
+    if (arithmetic_call(form, scope, op, guard))
+      return analyze_flat(form, scope, tail);
+    Compiled inlined = analyze_inline(form, scope);
+    if (inlined)
+      return inlined;
+  }
+  return analyze_call(form, scope);
+}
+
+void report_unresolved() {
+  vector<std::string> reported;
+  for (auto &[env, sym] : unresolved)
+    if (env->find(sym)->type != ENVIRONMENT and
+        std::find(reported.begin(), reported.end(), sym->value()) ==
+            reported.end()) {
+      warn(sym->value() + " is not defined");
+      reported.push_back(sym->value());
+    }
+  unresolved.clear();
+}
+
+void analyze_function(shared_ptr<Function> f) {
+  compile(f, make_shared<Scope>(nullptr, f->calling_env));
+}
+
+shared_ptr<Object> evaluate(shared_ptr<Object> ast,
+                            shared_ptr<Environment> env) {
+  shared_ptr<Scope> scope = make_shared<Scope>(nullptr, env);
+  Compiled code = analyze(ast, scope);
+  return code(make_shared<Environment>(env, scope->size));
+}
+
+} // namespace ml
@@ -0,0 +1,82 @@
+#pragma once
+#include "env.hpp"
+#include "types.hpp"
+#include <string>
+
+namespace ml {
+
+/*
+ * the slots a recur in tail position rebinds: the bindings of the innermost
+ * loop, or the parameters of the function.
+ * */
+struct RecurTarget {
+  vector<unsigned int> slots;
+  bool used = false;
+  // a loop rather than the parameters of the function
+  bool loop = false;
+};
+
+/*
+ * the analyzer turns the body of a fn* into a tree of closures (Compiled)
+ * once, when the fn* is evaluated, so that special forms, macro expansion and
+ * the position of every local are settled before the function is ever called.
+ *
+ * a Scope is the compile time image of the frame of one function: parameters
+ * and let* bindings get a slot index, and a local is then read at runtime by
+ * walking *depth* frames up and indexing the slots.
+ *
+ * the frame of a closure does not hang from the frame it is created in: its
+ * outer scope is a capture scope, which takes a slot for every variable of
+ * the enclosing scopes the closure actually uses. those values alone are
+ * copied when the closure is created.
+ *
+ * the body of a loop whose variables start as numbers is analyzed a second
+ * time with those variables unboxed, see analyze_loop().
+ * */
+class Scope {
+public:
+  Scope(shared_ptr<Scope> outer, shared_ptr<Environment> env);
+  unsigned int bind(const std::string &name);
+  void unbind(unsigned int count);
+  // gives the slot *index*, still bound, another name
+  void rename(unsigned int index, const std::string &name);
+  bool resolve(const std::string &name, unsigned int &depth,
+               unsigned int &index);
+  bool is_local(const std::string &name);
+  // number of slots needed by the frame
+  unsigned int size = 0;
+  shared_ptr<Scope> outer;
+  // environment the free symbols of the function are looked up in
+  shared_ptr<Environment> env;
+  shared_ptr<RecurTarget> target;
+  // for a capture scope, the scope the closure is created in and where every
+  // captured variable is read from there (depth and index)
+  shared_ptr<Scope> enclosing;
+  vector<std::pair<unsigned int, unsigned int>> captures;
+  // slots whose value is an unboxed double in Environment::numbers, and
+  // whether a closure has captured one of them
+  vector<bool> unboxed;
+  bool escaped = false;
+
+private:
+  vector<std::pair<std::string, unsigned int>> visible;
+};
+
+Compiled analyze(shared_ptr<Object> ast, shared_ptr<Scope> scope,
+                 bool tail = false);
+void analyze_function(shared_ptr<Function> f);
+// whether *form* is a (fn* ([params] body) ...) with one clause per arity
+bool is_multi_arity(shared_ptr<List> form);
+// whether the bindings of a let* or the parameters of a fn* destructure
+bool uses_destructuring(shared_ptr<List> form);
+// whether the quasiquote template *o* contains unquote or splice-unquote
+bool has_unquote(const shared_ptr<Object> &o);
+// warns about the globals code analyzed since the last call refers to that
+// are still not defined
+void report_unresolved();
+// analyzes and runs a single form, for the special forms only the analyzer
+// knows about
+shared_ptr<Object> evaluate(shared_ptr<Object> ast,
+                            shared_ptr<Environment> env);
+
+} // namespace ml
@@ -1,5 +1,6 @@
 #include "core.hpp"
 #include "extern.hpp"
+#include "mapped.hpp"
 #include "parser.hpp"
 #include "printer.hpp"
 #include "repl.hpp"
@@ -178,32 +179,33 @@ shared_ptr<Environment> initialize() {
           [](shared_ptr<List> args) {
             if (args->elements.size() > 0 and
                 args->elements[0]->type == FUNCTION) {
-              shared_ptr<List> fargs = list();
+              vector<shared_ptr<Object>> fargs;
               for (unsigned int i = 1; i < args->elements.size() - 1; i++) {
                 if (args->elements[i]->type == LIST) {
                   shared_ptr<List> tmp_list = to_list(args->elements[i]);
                   for (unsigned int i = 0; i < tmp_list->elements.size(); i++)
-                    fargs->append(tmp_list->elements[i]);
+                    fargs.push_back(tmp_list->elements[i]);
                 } else if (args->elements[i]->type == VEC) {
                   shared_ptr<Vec> tmp_vec = to_vec(args->elements[i]);
                   for (unsigned int i = 0; i < tmp_vec->elements.size(); i++)
-                    fargs->append(tmp_vec->elements[i]);
+                    fargs.push_back(tmp_vec->elements[i]);
                 } else {
-                  fargs->append(args->elements[i]);
+                  fargs.push_back(args->elements[i]);
                 }
               }
               shared_ptr<Object> last_element =
                   args->elements[args->elements.size() - 1];
               if (last_element->type == LIST) {
                 for (auto el : to_list(last_element)->elements)
-                  fargs->append(el);
+                  fargs.push_back(el);
               } else if (last_element->type == VEC) {
                 for (auto el : to_vec(last_element)->elements)
-                  fargs->append(el);
+                  fargs.push_back(el);
               } else {
-                fargs->append(last_element);
+                fargs.push_back(last_element);
               }
-              return to_function(args->elements[0])->call(fargs);
+              Invoker invoke(to_function(args->elements[0]));
+              return invoke.call(fargs.data(), fargs.size());
             } else {
               shared_ptr<Exception> ret =
                   exception("apply: bad parameter passed");
@@ -222,21 +224,14 @@ shared_ptr<Environment> initialize() {
                 (args->elements[1]->type == LIST or
                  args->elements[1]->type == VEC)) {
               shared_ptr<List> ret = list();
-              if (args->elements[1]->type == LIST) {
-                shared_ptr<List> tmp_list = to_list(args->elements[1]);
-                for (auto el : tmp_list->elements) {
-                  shared_ptr<List> fargs = list();
-                  fargs->append(el);
-                  ret->append(to_function(args->elements[0])->call(fargs));
-                }
-              } else {
-                shared_ptr<Vec> tmp_vec = to_vec(args->elements[1]);
-                for (auto el : tmp_vec->elements) {
-                  shared_ptr<List> fargs = list();
-                  fargs->append(el);
-                  ret->append(to_function(args->elements[0])->call(fargs));
-                }
-              }
+              Invoker invoke(to_function(args->elements[0]));
+              const vector<shared_ptr<Object>> &elements =
+                  args->elements[1]->type == LIST
+                      ? to_list(args->elements[1])->elements
+                      : to_vec(args->elements[1])->elements;
+              ret->elements.reserve(elements.size());
+              for (auto &el : elements)
+                ret->append(invoke.call(&el, 1));
               return to_obj(ret);
             } else {
               return to_obj(exception("map: bad parameter passed"));
@@ -271,13 +266,11 @@ shared_ptr<Environment> initialize() {
                               [](shared_ptr<List> args) {
                                 if (args->elements.size() > 0) {
                                   if (args->elements[0]->type == STRING) {
-                                    string filename =
-                                        to_str(args->elements[0])->value();
-                                    std::ifstream ifs(filename);
-                                    if (ifs.is_open()) {
-                                      std::stringstream buffer;
-                                      buffer << ifs.rdbuf();
-                                      return to_obj(str(buffer.str()));
+                                    MappedFile file(
+                                        to_str(args->elements[0])->value());
+                                    if (file.is_open()) {
+                                      return to_obj(
+                                          str(std::string(file.view())));
                                     } else {
                                       cout << "slurp: FILE IO ERROR" << endl;
                                       return to_obj(nil());
@@ -291,6 +284,17 @@ shared_ptr<Environment> initialize() {
                               },
                               "slurp"));
 
+  core->set(str("load-file"),
+            func(
+                [core](shared_ptr<List> args) {
+                  if (args->elements.size() != 1 or
+                      args->elements[0]->type != STRING)
+                    return to_obj(Runtime::ret_exception(
+                        "load-file: the argument must be a filename"));
+                  return load_file(to_str(args->elements[0])->value(), core);
+                },
+                "load-file"));
+
   core->set(str("+"), func(
                           [](shared_ptr<List> args) {
                             double sum = 0;
@@ -375,7 +379,9 @@ shared_ptr<Environment> initialize() {
                             if (args->elements.size() > 0) {
                               if (args->elements[0]->type == NUMBER) {
                                 tot += to_number(args->elements[0])->value();
-                                for (auto el : args->elements) {
+                                for (unsigned int i = 1;
+                                     i < args->elements.size(); i++) {
+                                  shared_ptr<Object> el = args->elements[i];
                                   if (el->type == NUMBER) {
                                     if (to_number(el)->value() != 0)
                                       tot /= to_number(el)->value();
@@ -563,13 +569,14 @@ shared_ptr<Environment> initialize() {
                   if (args->elements.size() > 2) {
                     if (args->elements[0]->type == ATOM and
                         args->elements[1]->type == FUNCTION) {
-                      shared_ptr<List> fargs = list();
-                      fargs->append(to_atom(args->elements[0])->value());
+                      vector<shared_ptr<Object>> fargs;
+                      fargs.push_back(to_atom(args->elements[0])->value());
                       for (unsigned int i = 2; i < args->elements.size(); i++) {
-                        fargs->append(args->elements[i]);
+                        fargs.push_back(args->elements[i]);
                       }
+                      Invoker invoke(to_function(args->elements[1]));
                       shared_ptr<Object> val =
-                          to_function(args->elements[1])->call(fargs);
+                          invoke.call(fargs.data(), fargs.size());
                       to_atom(args->elements[0])->set(val);
                       return val;
                     } else {
@@ -1243,11 +1250,8 @@ shared_ptr<Environment> initialize() {
                 return to_obj(ret);
               }
               case FUNCTION: {
-                shared_ptr<Function> orig = to_function(args->elements[0]),
-                                     ret =
-                                         func(orig->arguments, orig->expression,
-                                              orig->calling_env, orig->name, "",
-                                              orig->is_macro);
+                shared_ptr<Function> ret = std::make_shared<Function>(
+                    *to_function(args->elements[0]));
                 ret->meta = args->elements[1];
                 return to_obj(ret);
               }
@@ -1259,39 +1263,24 @@ shared_ptr<Environment> initialize() {
           },
           "with-meta"));
 
-  rep("(def! not (fn* (a) (if a false true)))", core);
+  /*
+   * builtins without side effects: a call to one of them with constant
+   * arguments is evaluated once by the analyzer and replaced by its result.
+   * */
+  for (std::string name :
+       {"+", "-", "*", "/", "=", ">", "<", ">=", "<=", "str", "pr-str", "list",
+        "concat", "vec", "keyword", "symbol", "get", "nil?", "symbol?",
+        "keyword?", "string?", "number?", "fn?", "vector?", "sequential?",
+        "map?", "list?"})
+    to_function(core->get(symbol(name)))->pure = true;
 
-  rep(R"(
-  (def! load-file (fn* (file)
-    (eval (read-string (slurp file)))
-  ))
-  )",
-      core);
+  rep("(def! not (fn* (a) (if a false true)))", core);
 
   rep(R"(
   (defmacro! test (fn* (x) x))
   )",
       core);
 
-  /* rep(R"(
-  (defmacro! cond
-    (fn* (& xs)
-      (if (> (count xs) 0)
-        (list 'if (first xs)
-          (if (> (count xs) 1)
-            (nth xs 1)
-            (throw \"odd number of forms to cond\"))
-          (cons 'cond (rest (rest xs)))))))
-  )",
-      core); */
-
-  rep("(defmacro! cond (fn* (& xs) (if (> (count xs) 0) (list 'if (first xs)"
-      "(if (> (count xs) 1) (nth xs 1) (throw \"odd number of forms to "
-      "cond\")) (cons 'cond (rest (rest xs)))))))",
-      core);
-
-  // rep("(defmacro! cond (fn* (& xs) (prn xs)))", core);
-
   rep("(def! *host-language* \"c++\")", core);
   return core;
 }
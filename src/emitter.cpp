@@ -0,0 +1,966 @@
+#include "emitter.hpp"
+#include "analyzer.hpp"
+#include "parser.hpp"
+#include "repl.hpp"
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+
+namespace ml {
+
+/*
+ * helpers every generated translation unit starts with. pending() and the
+ * call helpers mirror the exception handling of the analyzer.
+ * */
+static const char *prelude = R"(#include "mylisp.hpp"
+#include "parser.hpp"
+#include <initializer_list>
+#include <utility>
+using namespace ml;
+using Ref = shared_ptr<Object>;
+
+static shared_ptr<Environment> env;
+
+static bool pending() { return Runtime::unhandled_exc->type != NIL; }
+
+static Ref raise() {
+  check_exc();
+  return Runtime::unhandled_exc;
+}
+
+static bool truthy(const Ref &o) {
+  return not((o->type == BOOL and to_bool(o)->value() == false) or
+             o->type == NIL);
+}
+
+static Ref call(const shared_ptr<Function> &f, std::initializer_list<Ref> args) {
+  if (pending())
+    return raise();
+  shared_ptr<List> l = list();
+  l->elements = args;
+  Ref ret = f->call(l);
+  if (pending())
+    return raise();
+  return ret;
+}
+
+static Ref apply(const Ref &f, std::initializer_list<Ref> args) {
+  if (pending())
+    return raise();
+  if (f->type != FUNCTION)
+    return Runtime::ret_exception(
+        "invoke/apply: evaluating a list not starting with a function type");
+  return call(to_function(f), args);
+}
+
+static Ref lookup(const shared_ptr<Symbol> &s) { return env->get(s); }
+
+static Ref define(const shared_ptr<Symbol> &s, Ref v, bool is_macro = false) {
+  if (pending())
+    return raise();
+  if (is_macro)
+    v->is_macro = true;
+  env->set(s, v);
+  return v;
+}
+
+static Ref arity_error(const char *name) {
+  return Runtime::ret_exception(std::string("Funcion <") + name +
+                                ">: wrong number of parameters");
+}
+
+static Ref list_of(std::initializer_list<Ref> elements) {
+  shared_ptr<List> ret = list();
+  ret->elements = elements;
+  return ret;
+}
+
+static Ref vec_of(std::initializer_list<Ref> elements) {
+  shared_ptr<Vec> ret = vec();
+  ret->elements = elements;
+  return ret;
+}
+
+// a map literal, its keys are checked by Dict::append as the analyzer does
+static Ref dict_of(std::initializer_list<std::pair<Ref, Ref>> entries) {
+  shared_ptr<Dict> ret = dict();
+  for (auto &entry : entries)
+    ret->append(entry.first, entry.second);
+  if (pending())
+    return raise();
+  return ret;
+}
+
+// a quoted map, with any key the parser accepts
+static Ref dict_read(std::initializer_list<std::pair<Ref, Ref>> entries) {
+  shared_ptr<Dict> ret = dict();
+  for (auto &entry : entries)
+    ret->map.insert_or_assign(entry.first, entry.second);
+  return ret;
+}
+
+// a quasiquoted list or vector, the parts flagged true are spliced into it
+static Ref construct(bool is_vec, std::initializer_list<std::pair<Ref, bool>> parts) {
+  if (pending())
+    return raise();
+  vector<Ref> elements;
+  for (auto &part : parts) {
+    if (not part.second)
+      elements.push_back(part.first);
+    else if (part.first->type == LIST)
+      elements.insert(elements.end(), to_list(part.first)->elements.begin(),
+                      to_list(part.first)->elements.end());
+    else if (part.first->type == VEC)
+      elements.insert(elements.end(), to_vec(part.first)->elements.begin(),
+                      to_vec(part.first)->elements.end());
+    else
+      return Runtime::ret_exception(
+          "splice-unquote: the value must be a list or a vector");
+  }
+  if (is_vec) {
+    shared_ptr<Vec> ret = vec();
+    ret->elements = std::move(elements);
+    return ret;
+  }
+  shared_ptr<List> ret = list();
+  ret->elements = std::move(elements);
+  return ret;
+}
+
+static Ref rest_of(const shared_ptr<List> &args, unsigned int from) {
+  shared_ptr<List> ret = list();
+  for (unsigned int i = from; i < args->elements.size(); i++)
+    ret->append(args->elements[i]);
+  return ret;
+}
+
+static Ref arith(char op, const shared_ptr<Function> &f, const Ref (&v)[2]) {
+  if (v[0]->type == NUMBER and v[1]->type == NUMBER) {
+    double a = to_number(v[0])->value(), b = to_number(v[1])->value();
+    switch (op) {
+    case '+':
+      return number(a + b);
+    case '-':
+      return number(a - b);
+    case '*':
+      return number(a * b);
+    case '/':
+      if (b != 0)
+        return number(a / b);
+    }
+  }
+  return call(f, {v[0], v[1]});
+}
+
+static Ref compare(char op, const shared_ptr<Function> &f, const Ref (&v)[2]) {
+  static const Ref yes = boolean(true), no = boolean(false);
+  if (v[0]->type == NUMBER and v[1]->type == NUMBER) {
+    double a = to_number(v[0])->value(), b = to_number(v[1])->value();
+    switch (op) {
+    case '<':
+      return a < b ? yes : no;
+    case '>':
+      return a > b ? yes : no;
+    case 'l':
+      return a <= b ? yes : no;
+    case 'g':
+      return a >= b ? yes : no;
+    default:
+      return a == b ? yes : no;
+    }
+  }
+  return call(f, {v[0], v[1]});
+}
+)";
+
+static bool is_special(const std::string &name) {
+  return std::find(keywords.begin(), keywords.end(), name) != keywords.end();
+}
+
+// special forms translated to statements, see Emitter::stmt()
+static bool is_block(const std::string &name) {
+  return name == "do" or name == "let*" or name == "loop" or
+         name == "dotimes" or name == "doseq" or name == "try*" or
+         name == "cond" or name == "and" or name == "or" or name == "when";
+}
+
+static std::string literal(const std::string &s) {
+  std::ostringstream ret;
+  ret << '"';
+  for (unsigned char ch : s) {
+    if (ch == '"' or ch == '\\')
+      ret << '\\' << ch;
+    else if (ch == '\n')
+      ret << "\\n";
+    else if (ch < 32 or ch > 126)
+      ret << '\\' << std::oct << std::setw(3) << std::setfill('0')
+          << (unsigned int)ch << std::dec;
+    else
+      ret << ch;
+  }
+  ret << '"';
+  return ret.str();
+}
+
+static vector<shared_ptr<Object>> elements_of(shared_ptr<Object> o) {
+  if (o->type == LIST)
+    return to_list(o)->elements;
+  if (o->type == VEC)
+    return to_vec(o)->elements;
+  return {};
+}
+
+// a top level function that is called directly by its C++ name
+struct Direct {
+  std::string ident;
+  unsigned int arity;
+};
+
+class Emitter {
+public:
+  Emitter(shared_ptr<Environment> env) : env(env) {}
+  std::string translate(const std::string &source, const std::string &filename);
+
+private:
+  std::string expr(shared_ptr<Object> ast);
+  std::string stmt(shared_ptr<Object> ast);
+  std::string block(shared_ptr<Object> ast);
+  std::string call(shared_ptr<List> form);
+  std::string function(shared_ptr<Object> params, shared_ptr<Object> body,
+                       const std::string &name, Direct *direct);
+  std::string arities(shared_ptr<List> form, const std::string &name);
+  std::string quasiquoted(shared_ptr<Object> ast);
+  std::string iteration(shared_ptr<List> form, bool over_seq);
+  std::string try_catch(shared_ptr<List> form);
+  shared_ptr<Object> expand(shared_ptr<Object> ast);
+  std::string build(shared_ptr<Object> o);
+  std::string constant(shared_ptr<Object> o);
+  std::string symbol_ref(const std::string &name);
+  std::string builtin(const std::string &name);
+  std::string local(const std::string &name);
+  std::string bind(const std::string &name);
+  std::string fresh(const std::string &prefix);
+  void unsupported(const std::string &what);
+  void scan_definitions(shared_ptr<Object> ast);
+
+  shared_ptr<Environment> env;
+  vector<std::string> constants;
+  vector<std::string> symbols;
+  vector<std::string> builtins;
+  std::string functions;
+  std::unordered_map<std::string, Direct> direct;
+  std::unordered_map<std::string, unsigned int> definitions;
+  vector<std::pair<std::string, std::string>> locals;
+  // variables rebound by a recur in tail position, null outside loops
+  vector<std::string> *loop_vars = nullptr;
+  unsigned int counter = 0;
+  bool ok = true;
+};
+
+void Emitter::unsupported(const std::string &what) {
+  if (ok)
+    std::cerr << "emit-cpp: " << what << ", evaluated at runtime instead"
+              << std::endl;
+  ok = false;
+}
+
+std::string Emitter::fresh(const std::string &prefix) {
+  return prefix + std::to_string(counter++);
+}
+
+std::string Emitter::bind(const std::string &name) {
+  std::string ident = "v" + std::to_string(counter++) + "_";
+  for (char ch : name)
+    ident.push_back(isalnum(ch) ? ch : '_');
+  locals.push_back({name, ident});
+  return ident;
+}
+
+std::string Emitter::local(const std::string &name) {
+  for (auto it = locals.rbegin(); it != locals.rend(); it++)
+    if (it->first == name)
+      return it->second;
+  return "";
+}
+
+std::string Emitter::constant(shared_ptr<Object> o) {
+  std::string code = build(o);
+  auto found = std::find(constants.begin(), constants.end(), code);
+  if (found == constants.end()) {
+    constants.push_back(code);
+    found = constants.end() - 1;
+  }
+  return "K[" + std::to_string(found - constants.begin()) + "]";
+}
+
+std::string Emitter::symbol_ref(const std::string &name) {
+  auto found = std::find(symbols.begin(), symbols.end(), name);
+  if (found == symbols.end()) {
+    symbols.push_back(name);
+    found = symbols.end() - 1;
+  }
+  return "S[" + std::to_string(found - symbols.begin()) + "]";
+}
+
+std::string Emitter::builtin(const std::string &name) {
+  auto found = std::find(builtins.begin(), builtins.end(), name);
+  if (found == builtins.end()) {
+    builtins.push_back(name);
+    found = builtins.end() - 1;
+  }
+  return "B[" + std::to_string(found - builtins.begin()) + "]";
+}
+
+std::string Emitter::build(shared_ptr<Object> o) {
+  std::string ret;
+  switch (o->type) {
+  case NUMBER: {
+    std::ostringstream n;
+    n << std::setprecision(17) << to_number(o)->value();
+    return "to_obj(number(" + n.str() + "))";
+  }
+  case STRING:
+    return "to_obj(str(" + literal(to_str(o)->value()) + "))";
+  case KEYWORD:
+    return "to_obj(keyword(" + literal(to_keyword(o)->value()) + "))";
+  case SYMBOL:
+    return "to_obj(symbol(" + literal(to_symbol(o)->value()) + "))";
+  case BOOL:
+    return to_bool(o)->value() ? "to_obj(boolean(true))"
+                               : "to_obj(boolean(false))";
+  case NIL:
+    return "to_obj(nil())";
+  case LIST:
+  case VEC:
+    for (auto el : elements_of(o))
+      ret += (ret.empty() ? "" : ", ") + build(el);
+    return (o->type == LIST ? "list_of({" : "vec_of({") + ret + "})";
+  case DICT:
+    for (auto el : to_dict(o)->map)
+      ret += std::string(ret.empty() ? "" : ", ") + "{" + build(el.first) +
+             ", " + build(el.second) + "}";
+    return "dict_read({" + ret + "})";
+  default:
+    unsupported("constant of unsupported type");
+    return "to_obj(nil())";
+  }
+}
+
+/*
+ * same expansion as the analyzer: a local shadows a macro with its name.
+ * */
+shared_ptr<Object> Emitter::expand(shared_ptr<Object> ast) {
+  while (ast->type == LIST and not to_list(ast)->elements.empty() and
+         to_list(ast)->elements[0]->type == SYMBOL) {
+    shared_ptr<Symbol> head = to_symbol(to_list(ast)->elements[0]);
+    if (is_special(head->value()) or not local(head->value()).empty() or
+        env->find(head)->type != ENVIRONMENT)
+      break;
+    shared_ptr<Object> mf = env->get(head);
+    if (mf->type != FUNCTION or not mf->is_macro)
+      break;
+    shared_ptr<List> args = list();
+    for (unsigned int i = 1; i < to_list(ast)->elements.size(); i++)
+      args->append(to_list(ast)->elements[i]);
+    ast = to_function(mf)->call(args);
+  }
+  return ast;
+}
+
+void Emitter::scan_definitions(shared_ptr<Object> ast) {
+  if (ast->type != LIST and ast->type != VEC)
+    return;
+  vector<shared_ptr<Object>> elements = elements_of(ast);
+  if (ast->type == LIST and elements.size() > 1 and
+      elements[0]->type == SYMBOL and elements[1]->type == SYMBOL and
+      (to_symbol(elements[0])->value() == "def!" or
+       to_symbol(elements[0])->value() == "defmacro!"))
+    definitions[to_symbol(elements[1])->value()]++;
+  for (auto el : elements)
+    scan_definitions(el);
+}
+
+// EXPRESSIONS
+
+// a form that needs statements, as an expression
+std::string Emitter::block(shared_ptr<Object> ast) {
+  vector<std::string> *outer_loop = loop_vars;
+  loop_vars = nullptr;
+  std::string ret = "[&]() -> Ref {\n" + stmt(ast) + "}()";
+  loop_vars = outer_loop;
+  return ret;
+}
+
+std::string Emitter::expr(shared_ptr<Object> ast) {
+  switch (ast->type) {
+  case SYMBOL: {
+    const std::string &name = to_symbol(ast)->value();
+    std::string ident = local(name);
+    if (not ident.empty())
+      return ident;
+    if (is_special(name))
+      return constant(ast);
+    return "lookup(" + symbol_ref(name) + ")";
+  }
+  case VEC: {
+    std::string ret;
+    for (auto el : to_vec(ast)->elements)
+      ret += (ret.empty() ? "" : ", ") + expr(el);
+    return "vec_of({" + ret + "})";
+  }
+  case DICT: {
+    std::string ret;
+    for (auto el : to_dict(ast)->map)
+      ret += (ret.empty() ? "" : ", ") + ("{" + constant(el.first)) + ", " +
+             expr(el.second) + "}";
+    return "dict_of({" + ret + "})";
+  }
+  case LIST:
+    break;
+  default:
+    return constant(ast);
+  }
+
+  ast = expand(ast);
+  if (ast->type != LIST)
+    return expr(ast);
+  shared_ptr<List> form = to_list(ast);
+  if (form->elements.empty())
+    return constant(ast);
+  if (form->elements[0]->type != SYMBOL)
+    return call(form);
+
+  const std::string &name = to_symbol(form->elements[0])->value();
+  if (name == "quote" and form->elements.size() == 2)
+    return constant(form->elements[1]);
+  else if (name == "quasiquote" and form->elements.size() == 2)
+    return quasiquoted(form->elements[1]);
+  else if (name == "if" and
+           (form->elements.size() == 3 or form->elements.size() == 4))
+    return "(truthy(" + expr(form->elements[1]) + ") ? " +
+           expr(form->elements[2]) + " : " +
+           (form->elements.size() == 4 ? expr(form->elements[3])
+                                       : std::string("to_obj(nil())")) +
+           ")";
+  else if ((name == "def!" or name == "defmacro!") and
+           form->elements.size() == 3 and form->elements[1]->type == SYMBOL) {
+    const std::string &key = to_symbol(form->elements[1])->value();
+    auto found = direct.find(key);
+    if (name == "def!" and locals.empty() and found != direct.end()) {
+      /*
+       * the C++ function is emitted with the other functions, the binding
+       * wraps it so it can still be passed around and called dynamically.
+       * */
+      shared_ptr<List> fn = to_list(form->elements[2]);
+      std::string wrapper = function(fn->elements[1], fn->elements[2], key,
+                                     &found->second);
+      return "define(" + symbol_ref(key) + ", " + wrapper + ")";
+    }
+    std::string value;
+    shared_ptr<Object> fn = expand(form->elements[2]);
+    bool is_fn = fn->type == LIST and to_list(fn)->elements.size() > 1 and
+                 to_list(fn)->elements[0]->type == SYMBOL and
+                 to_symbol(to_list(fn)->elements[0])->value() == "fn*";
+    // a function bound by def! reports its name in arity errors
+    if (is_fn and is_multi_arity(to_list(fn)))
+      value = arities(to_list(fn), key);
+    else if (is_fn and to_list(fn)->elements.size() == 3)
+      value = function(to_list(fn)->elements[1], to_list(fn)->elements[2], key,
+                       nullptr);
+    else
+      value = expr(form->elements[2]);
+    return "define(" + symbol_ref(key) + ", " + value +
+           (name == "defmacro!" ? ", true)" : ")");
+  } else if (name == "fn*" and is_multi_arity(form))
+    return arities(form, "");
+  else if (name == "fn*" and form->elements.size() == 3)
+    return function(form->elements[1], form->elements[2], "", nullptr);
+  else if (is_block(name))
+    return block(ast);
+  else if (is_special(name) and local(name).empty()) {
+    unsupported("special form " + name + " outside of a supported position");
+    return "to_obj(nil())";
+  }
+  return call(form);
+}
+
+// the analyzer's construction plan for quasiquote templates, see
+// analyze_quasiquote()
+std::string Emitter::quasiquoted(shared_ptr<Object> ast) {
+  if (not has_unquote(ast))
+    return constant(ast);
+  vector<shared_ptr<Object>> elements = elements_of(ast);
+  if (ast->type == LIST and elements.size() == 2 and
+      elements[0]->type == SYMBOL and
+      to_symbol(elements[0])->value() == "unquote")
+    return expr(elements[1]);
+  std::string parts;
+  for (auto el : elements) {
+    vector<shared_ptr<Object>> inner = elements_of(el);
+    bool spliced = el->type == LIST and inner.size() == 2 and
+                   inner[0]->type == SYMBOL and
+                   to_symbol(inner[0])->value() == "splice-unquote";
+    std::string part = spliced ? expr(inner[1]) : quasiquoted(el);
+    parts += std::string(parts.empty() ? "" : ", ") + "{" + part + ", " +
+             (spliced ? "true" : "false") + "}";
+  }
+  return std::string("construct(") + (ast->type == VEC ? "true" : "false") +
+         ", {" + parts + "})";
+}
+
+std::string Emitter::call(shared_ptr<List> form) {
+  vector<std::string> args;
+  for (unsigned int i = 1; i < form->elements.size(); i++)
+    args.push_back(expr(form->elements[i]));
+  std::string joined;
+  for (auto &arg : args)
+    joined += (joined.empty() ? "" : ", ") + arg;
+
+  if (form->elements[0]->type == SYMBOL) {
+    const std::string &name = to_symbol(form->elements[0])->value();
+    if (local(name).empty()) {
+      auto found = direct.find(name);
+      if (found != direct.end() and found->second.arity == args.size())
+        return found->second.ident + "(" +
+               (args.empty() ? "" : "{" + joined + "}") + ")";
+      shared_ptr<Symbol> sym = symbol(name);
+      if (not definitions.contains(name) and
+          env->find(sym)->type == ENVIRONMENT and
+          env->get(sym)->type == FUNCTION and
+          to_function(env->get(sym))->compiled) {
+        static const std::unordered_map<std::string, std::string> inlined = {
+            {"+", "arith('+'"},  {"-", "arith('-'"},   {"*", "arith('*'"},
+            {"/", "arith('/'"},  {"<", "compare('<'"}, {">", "compare('>'"},
+            {"<=", "compare('l'"}, {">=", "compare('g'"}, {"=", "compare('='"}};
+        auto op = inlined.find(name);
+        if (op != inlined.end() and args.size() == 2)
+          return op->second + ", " + builtin(name) + ", {" + joined + "})";
+        return "call(" + builtin(name) + ", {" + joined + "})";
+      }
+    }
+  }
+  return "apply(" + expr(form->elements[0]) + ", {" + joined + "})";
+}
+
+// STATEMENTS
+
+// statements computing *ast* in tail position: they return or, for a recur,
+// rebind the loop variables and continue
+std::string Emitter::stmt(shared_ptr<Object> ast) {
+  ast = expand(ast);
+  if (ast->type != LIST or to_list(ast)->elements.empty() or
+      to_list(ast)->elements[0]->type != SYMBOL or
+      not local(to_symbol(to_list(ast)->elements[0])->value()).empty())
+    return "return " + expr(ast) + ";\n";
+  shared_ptr<List> form = to_list(ast);
+  const std::string &name = to_symbol(form->elements[0])->value();
+
+  if (name == "if" and
+      (form->elements.size() == 3 or form->elements.size() == 4)) {
+    std::string condition = expr(form->elements[1]);
+    return "if (truthy(" + condition + ")) {\n" + stmt(form->elements[2]) +
+           "} else {\n" +
+           (form->elements.size() == 4 ? stmt(form->elements[3])
+                                       : "return to_obj(nil());\n") +
+           "}\n";
+  } else if (name == "cond" and form->elements.size() % 2 == 1) {
+    std::string ret;
+    for (unsigned int i = 1; i < form->elements.size(); i += 2)
+      ret += "if (truthy(" + expr(form->elements[i]) + ")) {\n" +
+             stmt(form->elements[i + 1]) + "}\n";
+    return ret + "return to_obj(nil());\n";
+  } else if (name == "and" or name == "or") {
+    if (form->elements.size() == 1)
+      return name == "and" ? "return to_obj(boolean(true));\n"
+                           : "return to_obj(nil());\n";
+    std::string ret;
+    for (unsigned int i = 1; i < form->elements.size() - 1; i++) {
+      std::string value = fresh("a");
+      ret += "{\nRef " + value + " = " + expr(form->elements[i]) +
+             ";\nif (pending())\nreturn raise();\nif (" +
+             (name == "and" ? "not " : "") + "truthy(" + value +
+             "))\nreturn " + value + ";\n}\n";
+    }
+    return ret + stmt(form->elements.back());
+  } else if (name == "when" and form->elements.size() > 1) {
+    std::string ret = "if (truthy(" + expr(form->elements[1]) + ")) {\n";
+    for (unsigned int i = 2; i + 1 < form->elements.size(); i++)
+      ret += expr(form->elements[i]) + ";\n";
+    ret += form->elements.size() > 2 ? stmt(form->elements.back())
+                                     : "return to_obj(nil());\n";
+    return ret + "}\nreturn to_obj(nil());\n";
+  } else if (name == "do" and form->elements.size() > 1) {
+    std::string ret;
+    for (unsigned int i = 1; i < form->elements.size() - 1; i++)
+      ret += expr(form->elements[i]) + ";\n";
+    return ret + stmt(form->elements.back());
+  } else if ((name == "let*" and form->elements.size() == 3) or
+             (name == "loop" and form->elements.size() >= 3)) {
+    vector<shared_ptr<Object>> bindings = elements_of(form->elements[1]);
+    if (bindings.size() % 2 != 0 or
+        (form->elements[1]->type != LIST and form->elements[1]->type != VEC)) {
+      unsupported(name + " with malformed bindings");
+      return "return to_obj(nil());\n";
+    }
+    std::string ret = "{\n";
+    vector<std::string> vars;
+    for (unsigned int i = 0; i < bindings.size(); i += 2) {
+      if (bindings[i]->type != SYMBOL) {
+        unsupported(name + " with malformed bindings");
+        return "return to_obj(nil());\n";
+      }
+      std::string value = expr(bindings[i + 1]);
+      vars.push_back(bind(to_symbol(bindings[i])->value()));
+      ret += "Ref " + vars.back() + " = " + value + ";\n";
+    }
+    if (name == "let*")
+      ret += stmt(form->elements[2]);
+    else {
+      vector<std::string> *outer_loop = loop_vars;
+      loop_vars = &vars;
+      ret += "while (true) {\n";
+      for (unsigned int i = 2; i < form->elements.size() - 1; i++)
+        ret += expr(form->elements[i]) + ";\n";
+      ret += stmt(form->elements.back()) + "}\n";
+      loop_vars = outer_loop;
+    }
+    locals.resize(locals.size() - vars.size());
+    return ret + "}\n";
+  } else if (name == "recur") {
+    if (loop_vars == nullptr or
+        loop_vars->size() != form->elements.size() - 1) {
+      unsupported("recur outside of tail position or with wrong arity");
+      return "return to_obj(nil());\n";
+    }
+    vector<std::string> *vars = loop_vars;
+    loop_vars = nullptr;
+    std::string ret = "{\n";
+    vector<std::string> scratch;
+    for (unsigned int i = 1; i < form->elements.size(); i++) {
+      scratch.push_back(fresh("t"));
+      ret += "Ref " + scratch.back() + " = " + expr(form->elements[i]) + ";\n";
+    }
+    ret += "if (pending())\nreturn raise();\n";
+    for (unsigned int i = 0; i < scratch.size(); i++)
+      ret += (*vars)[i] + " = std::move(" + scratch[i] + ");\n";
+    loop_vars = vars;
+    return ret + "continue;\n}\n";
+  } else if (name == "dotimes" or name == "doseq")
+    return iteration(form, name == "doseq");
+  else if (name == "try*")
+    return try_catch(form);
+  else if (is_block(name)) {
+    unsupported("malformed " + name);
+    return "return to_obj(nil());\n";
+  }
+  return "return " + expr(ast) + ";\n";
+}
+
+std::string Emitter::iteration(shared_ptr<List> form, bool over_seq) {
+  vector<shared_ptr<Object>> binding = elements_of(form->elements[1]);
+  if (form->elements.size() < 3 or binding.size() != 2 or
+      binding[0]->type != SYMBOL) {
+    unsupported("malformed dotimes/doseq");
+    return "return to_obj(nil());\n";
+  }
+  vector<std::string> *outer_loop = loop_vars;
+  loop_vars = nullptr;
+  std::string value = fresh("n");
+  std::string ret = "{\nRef " + value + " = " + expr(binding[1]) + ";\n";
+  ret += "if (pending())\nreturn raise();\n";
+  std::string var = bind(to_symbol(binding[0])->value());
+  std::string body;
+  for (unsigned int i = 2; i < form->elements.size(); i++)
+    body += expr(form->elements[i]) + ";\n";
+  body += "if (pending())\nreturn raise();\n";
+  if (over_seq) {
+    std::string elements = fresh("e");
+    ret += "if (" + value + "->type == NIL)\nreturn to_obj(nil());\n";
+    ret += "if (" + value + "->type != LIST and " + value +
+           "->type != VEC)\nreturn Runtime::ret_exception(\"doseq: only list "
+           "or vec can be iterated\");\n";
+    ret += "const vector<Ref> &" + elements + " = " + value +
+           "->type == LIST ? to_list(" + value + ")->elements : to_vec(" +
+           value + ")->elements;\n";
+    ret += "for (const Ref &" + var + " : " + elements + ") {\n" + body + "}\n";
+  } else {
+    std::string i = fresh("i");
+    ret += "if (" + value +
+           "->type != NUMBER)\nreturn Runtime::ret_exception(\"dotimes: count "
+           "must be a number\");\n";
+    ret += "for (double " + i + " = 0; " + i + " < to_number(" + value +
+           ")->value(); " + i + "++) {\nRef " + var + " = number(" + i +
+           ");\n" + body + "}\n";
+  }
+  locals.pop_back();
+  loop_vars = outer_loop;
+  return ret + "return to_obj(nil());\n}\n";
+}
+
+std::string Emitter::try_catch(shared_ptr<List> form) {
+  if (not(form->elements.size() == 3 and form->elements[2]->type == LIST and
+          to_list(form->elements[2])->elements.size() == 3 and
+          to_list(form->elements[2])->elements[1]->type == SYMBOL)) {
+    unsupported("malformed try*");
+    return "return to_obj(nil());\n";
+  }
+  shared_ptr<List> catch_form = to_list(form->elements[2]);
+  vector<std::string> *outer_loop = loop_vars;
+  loop_vars = nullptr;
+  std::string was = fresh("was"), ret = fresh("r");
+  std::string code = "{\nbool " + was + " = catching;\ncatching = true;\nRef " +
+                     ret + " = " + expr(form->elements[1]) + ";\ncatching = " +
+                     was + ";\n";
+  std::string var = bind(to_symbol(catch_form->elements[1])->value());
+  code += "if (" + ret + "->type == EXCEPTION or pending()) {\nRef " + var +
+          " = pending() ? Runtime::unhandled_exc : " + ret +
+          ";\nRuntime::unhandled_exc = nil();\n" +
+          stmt(catch_form->elements[2]) + "}\nreturn " + ret + ";\n}\n";
+  locals.pop_back();
+  loop_vars = outer_loop;
+  return code;
+}
+
+// FUNCTIONS
+
+/*
+ * a fn* becomes a C++ lambda wrapped in a builtin Function; with *direct* the
+ * body goes into a static C++ function and the lambda only unpacks the
+ * argument list for it.
+ * */
+std::string Emitter::function(shared_ptr<Object> params,
+                              shared_ptr<Object> body,
+                              const std::string &name, Direct *direct) {
+  vector<shared_ptr<Object>> elements = elements_of(params);
+  int variadic = -1;
+  for (unsigned int i = 0; i < elements.size(); i++) {
+    if (elements[i]->type != SYMBOL) {
+      unsupported("fn* with parameters that are not symbols");
+      return "to_obj(nil())";
+    }
+    if (to_symbol(elements[i])->value() == "&")
+      variadic = i;
+  }
+  if (variadic >= 0 and variadic != (int)elements.size() - 2) {
+    unsupported("fn* with misplaced &");
+    return "to_obj(nil())";
+  }
+  unsigned int fixed = variadic >= 0 ? variadic : elements.size();
+
+  vector<std::pair<std::string, std::string>> outer_locals = locals;
+  vector<std::string> *outer_loop = loop_vars;
+  if (direct != nullptr)
+    locals.clear();
+  vector<std::string> vars;
+  std::string unpack;
+  for (unsigned int i = 0; i < fixed; i++) {
+    vars.push_back(bind(to_symbol(elements[i])->value()));
+    unpack += "Ref " + vars.back() + " = " +
+              (direct != nullptr ? "a[" : "args->elements[") +
+              std::to_string(i) + "];\n";
+  }
+  if (variadic >= 0) {
+    vars.push_back(bind(to_symbol(elements.back())->value()));
+    unpack += "Ref " + vars.back() + " = rest_of(args, " +
+              std::to_string(fixed) + ");\n";
+  }
+  loop_vars = &vars;
+  std::string code = unpack + "while (true) {\n" + stmt(body) + "}\n";
+  loop_vars = outer_loop;
+  locals = outer_locals;
+
+  std::string label = literal(name);
+  std::string check =
+      variadic >= 0
+          ? "if (args->elements.size() < " + std::to_string(fixed) + ")\n"
+          : "if (args->elements.size() != " + std::to_string(fixed) + ")\n";
+  check += "return arity_error(" + label + ");\n";
+  if (direct == nullptr)
+    return "to_obj(func([=](shared_ptr<List> args) -> Ref {\n" + check + code +
+           "}, " + label + "))";
+
+  std::string signature =
+      "static Ref " + direct->ident + "(" +
+      (fixed == 0 ? std::string("") : "const Ref (&a)[" + std::to_string(fixed) + "]") +
+      ")";
+  functions += signature + " {\n" + code + "}\n\n";
+  std::string forward;
+  for (unsigned int i = 0; i < fixed; i++)
+    forward += std::string(i ? ", " : "") + "args->elements[" +
+               std::to_string(i) + "]";
+  return "to_obj(func([](shared_ptr<List> args) -> Ref {\n" + check +
+         "return " + direct->ident + "(" +
+         (fixed == 0 ? "" : "{" + forward + "}") + ");\n}, " + label + "))";
+}
+
+// every clause of a multi-arity fn* becomes a function of its own, and the
+// dispatch switches over the number of arguments
+std::string Emitter::arities(shared_ptr<List> form, const std::string &name) {
+  std::string clauses, cases, rest;
+  for (unsigned int i = 1; i < form->elements.size(); i++) {
+    shared_ptr<List> clause = to_list(form->elements[i]);
+    if (clause->elements.size() != 2) {
+      unsupported("malformed fn* clause");
+      return "to_obj(nil())";
+    }
+    std::string var = fresh("c");
+    clauses += "Ref " + var + " = " +
+               function(clause->elements[0], clause->elements[1], name,
+                        nullptr) +
+               ";\n";
+    vector<shared_ptr<Object>> params = elements_of(clause->elements[0]);
+    bool variadic = false;
+    for (auto el : params)
+      if (el->type == SYMBOL and to_symbol(el)->value() == "&")
+        variadic = true;
+    std::string forward = "return to_function(" + var + ")->call(args);\n";
+    if (variadic)
+      rest = "if (args->elements.size() >= " +
+             std::to_string(params.size() - 2) + ")\n" + forward;
+    else
+      cases += "case " + std::to_string(params.size()) + ":\n" + forward;
+  }
+  std::string label = literal(name);
+  return "[&]() -> Ref {\n" + clauses +
+         "return to_obj(func([=](shared_ptr<List> args) -> Ref {\n"
+         "switch (args->elements.size()) {\n" +
+         cases + "}\n" + rest + "return arity_error(" + label + ");\n}, " +
+         label + "));\n}()";
+}
+
+// TRANSLATION UNIT
+
+// indents the generated code by its braces, skipping string literals
+static std::string indent(const std::string &code) {
+  std::istringstream in(code);
+  std::string out, line;
+  int depth = 0;
+  while (std::getline(in, line)) {
+    int opened = 0;
+    bool quoted = false;
+    for (unsigned int i = 0; i < line.size(); i++) {
+      if (line[i] == '\\')
+        i++;
+      else if (line[i] == '"')
+        quoted = not quoted;
+      else if (not quoted and line[i] == '{')
+        opened++;
+      else if (not quoted and line[i] == '}')
+        opened--;
+    }
+    int level = depth + (line.starts_with("}") ? -1 : 0);
+    out += std::string(line.empty() ? 0 : 2 * std::max(level, 0), ' ') + line +
+           "\n";
+    depth += opened;
+  }
+  return out;
+}
+
+std::string Emitter::translate(const std::string &source,
+                               const std::string &filename) {
+  Parser p;
+  shared_ptr<Object> root = p.parse(source);
+  vector<shared_ptr<Object>> forms;
+  if (root->type == VEC)
+    forms = to_vec(root)->elements;
+  else if (root->type != NIL)
+    forms.push_back(root);
+
+  for (auto form : forms)
+    scan_definitions(form);
+  for (auto form : forms) {
+    vector<shared_ptr<Object>> elements = elements_of(form);
+    if (form->type == LIST and elements.size() == 3 and
+        elements[0]->type == SYMBOL and
+        to_symbol(elements[0])->value() == "def!" and
+        elements[1]->type == SYMBOL and
+        definitions[to_symbol(elements[1])->value()] == 1 and
+        elements[2]->type == LIST and
+        to_list(elements[2])->elements.size() == 3 and
+        to_list(elements[2])->elements[0]->type == SYMBOL and
+        to_symbol(to_list(elements[2])->elements[0])->value() == "fn*") {
+      vector<shared_ptr<Object>> params =
+          elements_of(to_list(elements[2])->elements[1]);
+      bool fixed = true;
+      for (auto el : params)
+        if (el->type != SYMBOL or to_symbol(el)->value() == "&")
+          fixed = false;
+      if (fixed) {
+        std::string name = to_symbol(elements[1])->value();
+        direct[name] = {fresh("f_"), (unsigned int)params.size()};
+        for (char ch : name)
+          direct[name].ident.push_back(isalnum(ch) ? ch : '_');
+      }
+    }
+  }
+
+  std::string main_body;
+  std::unordered_map<std::string, bool> emitted;
+  for (auto form : forms) {
+    ok = true;
+    std::string saved_functions = functions;
+    std::string code = expr(form);
+    if (form->type == LIST and not to_list(form)->elements.empty() and
+        to_list(form)->elements[0]->type == SYMBOL and
+        to_symbol(to_list(form)->elements[0])->value() == "defmacro!")
+      // later forms are expanded with the macros of the file
+      EVAL(form, env);
+    if (ok) {
+      main_body += code + ";\n";
+      continue;
+    }
+    functions = saved_functions;
+    main_body += "EVAL(" + constant(form) + ", env);\n";
+  }
+
+  /*
+   * a direct function whose definition could not be translated forwards to
+   * whatever the interpreter bound to its name.
+   * */
+  std::string declarations;
+  for (auto &entry : direct) {
+    std::string params, forward;
+    for (unsigned int i = 0; i < entry.second.arity; i++)
+      forward += std::string(i ? ", " : "") + "a[" + std::to_string(i) + "]";
+    if (entry.second.arity > 0)
+      params = "const Ref (&a)[" + std::to_string(entry.second.arity) + "]";
+    declarations += "static Ref " + entry.second.ident + "(" + params + ");\n";
+    if (functions.find("static Ref " + entry.second.ident + "(") ==
+        std::string::npos)
+      functions += "static Ref " + entry.second.ident + "(" + params +
+                   ") {\nreturn apply(lookup(" + symbol_ref(entry.first) +
+                   "), {" + forward + "});\n}\n\n";
+  }
+
+  std::string out = "static Ref K[" + std::to_string(constants.size() + 1) + "];\n";
+  out += "static shared_ptr<Symbol> S[" + std::to_string(symbols.size() + 1) +
+         "];\n";
+  out += "static shared_ptr<Function> B[" +
+         std::to_string(builtins.size() + 1) + "];\n\n";
+  out += declarations + "\n" + functions;
+  out += "int main(int argc, char **argv) {\nRuntime rnt;\nenv = rnt.env();\n";
+  for (unsigned int i = 0; i < constants.size(); i++)
+    out += "K[" + std::to_string(i) + "] = " + constants[i] + ";\n";
+  for (unsigned int i = 0; i < symbols.size(); i++)
+    out += "S[" + std::to_string(i) + "] = symbol(" + literal(symbols[i]) +
+           ");\n";
+  for (unsigned int i = 0; i < builtins.size(); i++)
+    out += "B[" + std::to_string(i) + "] = to_function(env->get(symbol(" +
+           literal(builtins[i]) + ")));\n";
+  out += "shared_ptr<List> eargv = list();\nParser p;\n"
+         "for (int i = 1; i < argc; i++) {\neargv->append(p.parse(argv[i]));\n}\n"
+         "env->set(str(\"*ARGV*\"), eargv);\n";
+  out += main_body + "return 0;\n}\n";
+  return std::string("// generated by mylisp --emit-cpp from ") + filename +
+         ", do not edit\n" + prelude + "\n" + indent(out);
+}
+
+std::string emit_cpp(const std::string &source, const std::string &filename,
+                     shared_ptr<Environment> env) {
+  Emitter emitter(env);
+  return emitter.translate(source, filename);
+}
+
+} // namespace ml
@@ -0,0 +1,22 @@
+#pragma once
+#include "env.hpp"
+#include "types.hpp"
+#include <string>
+
+namespace ml {
+
+/*
+ * translates the top level forms of a mylisp source into a C++ translation
+ * unit linking against libmylisp (mylisp --emit-cpp FILE).
+ *
+ * forms are macro expanded with the macros of *env* and of the defmacro! of
+ * the file itself. locals become C++ variables, builtins are resolved once at
+ * startup and called directly, and functions defined once at top level with
+ * (def! name (fn* (params) body)) become C++ functions called directly by the
+ * other functions of the file. a form that cannot be translated is evaluated
+ * by the interpreter at runtime instead.
+ * */
+std::string emit_cpp(const std::string &source, const std::string &filename,
+                     shared_ptr<Environment> env);
+
+} // namespace ml
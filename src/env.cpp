@@ -5,17 +5,30 @@
 using std::cout, std::endl;
 
 namespace ml {
-Environment::Environment(shared_ptr<Environment> outer) : Object(ENVIRONMENT) {
+unsigned long Environment::epoch = 0;
+
+Environment::Environment(shared_ptr<Environment> outer, unsigned int size)
+    : Object(ENVIRONMENT), slots(size) {
   _outer = outer;
 }
 
 void Environment::set(shared_ptr<Object> key, shared_ptr<Object> value) {
+  if ((key->type == STRING or key->type == SYMBOL) and
+      is_sealed(key->type == STRING ? to_str(key)->value()
+                                    : to_symbol(key)->value())) {
+    Runtime::ret_exception("cannot rebind " +
+                           (key->type == STRING ? to_str(key)->value()
+                                                : to_symbol(key)->value()) +
+                           ": the core is sealed");
+    return;
+  }
+  epoch++;
   switch (key->type) {
   case STRING:
-    map.insert_or_assign(to_str(key)->value(), value);
+    bind(to_str(key)->value(), value);
     break;
   case SYMBOL:
-    map.insert_or_assign(to_symbol(key)->value(), value);
+    bind(to_symbol(key)->value(), value);
     break;
   default:
     cout << "key type not valid (only string or keyword may be a key)" << endl;
@@ -23,17 +36,22 @@ void Environment::set(shared_ptr<Object> key, shared_ptr<Object> value) {
   }
 }
 
+// a new name gets a cell, an existing one is updated in place
+void Environment::bind(const std::string &name, shared_ptr<Object> value) {
+  Cell &cell = map[name];
+  cell.value = std::move(value);
+  cell.version++;
+}
+
+Cell *Environment::cell(const std::string &name) { return &map[name]; }
+
 shared_ptr<Environment> Environment::find(shared_ptr<Symbol> key) {
-  std::string key_string = key->value();
-  if (map.contains(key_string)) {
+  auto found = map.find(key->value());
+  if (found != map.end() and found->second.value != nullptr)
     return shared_from_this();
-  } else {
-  }
-  if (_outer->type == ENVIRONMENT and _outer->find(key)->type == ENVIRONMENT) {
+  if (_outer->type == ENVIRONMENT)
     return _outer->find(key);
-  } else {
-    return to<Environment, Nil>(nil());
-  }
+  return to<Environment, Nil>(nil());
 }
 
 shared_ptr<Object> Environment::get(shared_ptr<Symbol> key) {
@@ -51,8 +69,7 @@ shared_ptr<Object> Environment::get(shared_ptr<Symbol> key) {
       return to_obj(Runtime::ret_exception(
           "key type not valid (only string or keyword may be a key)"));
     }
-    auto ret = fe->map.at(key_string);
-    return ret;
+    return fe->map.at(key_string).value;
   } else {
     shared_ptr<Exception> exc =
         exception("Symbol not found exception.\n" + to_symbol(key)->value());
@@ -62,17 +79,104 @@ shared_ptr<Object> Environment::get(shared_ptr<Symbol> key) {
 }
 
 std::string Environment::get_key(shared_ptr<Object> obj){
-  for (auto el : map) {
-    if (el.second == obj) {
+  for (auto &el : map) {
+    if (el.second.value == obj) {
       return el.first;
     }
   }
-  if (_outer != to<Environment>(nil()))
+  if (_outer->type == ENVIRONMENT)
     return _outer->get_key(obj);
   else
     return "nil";
 }
 
+shared_ptr<Environment> Environment::outer() { return _outer; }
+
+void Environment::reuse(const shared_ptr<Environment> &outer,
+                        unsigned int size) {
+  _outer = outer;
+  slots.resize(size);
+  values_wanted = false;
+}
+
+void Environment::seal() {
+  for (auto &el : map)
+    if (el.second.value != nullptr)
+      sealed.insert(el.first);
+}
+
+bool Environment::is_sealed(const std::string &name) const {
+  return not sealed.empty() and sealed.contains(name);
+}
+
+void Environment::release() {
+  slots.clear();
+  map.clear();
+  _outer.reset();
+}
+
+// FRAME
+
+std::deque<shared_ptr<Environment>> Frame::stack;
+unsigned int Frame::top = 0;
+
+Frame::Frame(const shared_ptr<Environment> &outer, unsigned int size)
+    : frame(top < stack.size() ? stack[top] : stack.emplace_back()) {
+  top++;
+  if (frame != nullptr and frame.use_count() == 1)
+    frame->reuse(outer, size);
+  else
+    frame = make_shared<Environment>(outer, size);
+}
+
+Frame::~Frame() {
+  top--;
+  if (frame.use_count() == 1)
+    frame->release();
+}
+
+// INVOKER
+
+Invoker::Invoker(shared_ptr<Function> f) : f(f) {}
+
+shared_ptr<Object> Invoker::call(const shared_ptr<Object> *args,
+                                 unsigned int count) {
+  if (f->compiled or f->code == nullptr) {
+    if (buffer == nullptr or buffer.use_count() != 1)
+      buffer = list();
+    buffer->elements.assign(args, args + count);
+    return f->call(buffer);
+  }
+  if (clause == nullptr or count != this->count) {
+    clause = f->dispatch(count);
+    if (clause != nullptr)
+      fixed = clause->last_is_variadic >= 0
+                  ? clause->last_is_variadic
+                  : clause->arguments->elements.size();
+    if (clause == nullptr or count < fixed or
+        (clause->last_is_variadic < 0 and count != fixed)) {
+      clause = nullptr;
+      return to_obj(Runtime::ret_exception(
+          "Funcion <" + f->calling_env->get_key(f) +
+          ">: wrong number of parameters"));
+    }
+    this->count = count;
+  }
+  if (frame != nullptr and frame.use_count() == 1)
+    frame->reuse(f->calling_env, clause->code->frame_size);
+  else
+    frame = make_shared<Environment>(f->calling_env, clause->code->frame_size);
+  for (unsigned int i = 0; i < fixed; i++)
+    frame->slots[i] = args[i];
+  if (clause->last_is_variadic >= 0) {
+    shared_ptr<List> varargs = list();
+    for (unsigned int i = fixed; i < count; i++)
+      varargs->append(args[i]);
+    frame->slots[fixed] = varargs;
+  }
+  return clause->code->body(frame);
+}
+
 shared_ptr<Environment> to_environment(shared_ptr<Object> o) {
   return std::static_pointer_cast<Environment>(o);
 }
@@ -1,22 +1,101 @@
 #pragma once
 #include "types.hpp"
+#include <deque>
 #include <unordered_map>
+#include <unordered_set>
 
 namespace ml {
 
+/*
+ * the binding of a name in an environment. a cell stays at the same address as
+ * long as its environment lives, so analyzed code can keep a pointer to it:
+ * rebinding the name updates the value in place and bumps the version. a cell
+ * without a value declares a name that is not bound yet.
+ * */
+struct Cell {
+  shared_ptr<Object> value;
+  unsigned long version = 0;
+};
+
 class Environment : public Object,
                     public std::enable_shared_from_this<Environment> {
 public:
-  Environment(shared_ptr<Environment> outer = to<Environment, Nil>(nil()));
+  Environment(shared_ptr<Environment> outer = to<Environment, Nil>(nil()),
+              unsigned int size = 0);
   void set(shared_ptr<Object> key, shared_ptr<Object> value);
   shared_ptr<Environment> find(shared_ptr<Symbol> key);
   shared_ptr<Object> get(shared_ptr<Symbol> key);
   std::string get_key(shared_ptr<Object> obj);
+  // the cell of *name* in this environment, declared if it has none yet
+  Cell *cell(const std::string &name);
+  shared_ptr<Environment> outer();
+  // prepares a frame released by a previous call for a new one
+  void reuse(const shared_ptr<Environment> &outer, unsigned int size);
+  void release();
+  // makes the names bound so far permanent: set() refuses to rebind them and
+  // the analyzer binds references to them once (mylisp --sealed)
+  void seal();
+  bool is_sealed(const std::string &name) const;
+  // incremented by every set(), lets caches know a binding may have changed
+  static unsigned long epoch;
+  // locals of an analyzed function, addressed by index instead of by name
+  vector<shared_ptr<Object>> slots;
+  // numeric locals a specialised loop keeps unboxed, indexed like slots
+  vector<double> numbers;
+  // set on the frame of a call whose caller takes several values back, see
+  // let-values in analyzer.cpp
+  bool values_wanted = false;
 
 private:
-  std::unordered_map<std::string, shared_ptr<Object>> map;
+  void bind(const std::string &name, shared_ptr<Object> value);
+  std::unordered_map<std::string, Cell> map;
+  std::unordered_set<std::string> sealed;
   shared_ptr<Environment> _outer;
 };
 
+/*
+ * the frame of a call to an analyzed function. nothing the analyzer produces
+ * keeps a frame after the call has returned (closures copy the values they
+ * capture, eval runs in the global environment), so frames come from a stack
+ * owned by the evaluator and the next call at the same depth reuses them. a
+ * frame still referenced from elsewhere when its turn comes is left to its
+ * owners and replaced by a new one.
+ * */
+class Frame {
+public:
+  Frame(const shared_ptr<Environment> &outer, unsigned int size);
+  ~Frame();
+  Frame(const Frame &) = delete;
+  Frame &operator=(const Frame &) = delete;
+  const shared_ptr<Environment> &env() const { return frame; }
+
+private:
+  shared_ptr<Environment> &frame;
+  static std::deque<shared_ptr<Environment>> stack;
+  static unsigned int top;
+};
+
+/*
+ * calls one function over and over, for the builtins that apply a function to
+ * many values (map, apply, swap!). the clause is looked up again only when
+ * the number of arguments changes, an analyzed function gets its arguments
+ * straight into the slots of a frame the invoker keeps for the next call
+ * unless the previous one left it shared, and a builtin gets a list of
+ * arguments reused on the same terms.
+ * */
+class Invoker {
+public:
+  Invoker(shared_ptr<Function> f);
+  shared_ptr<Object> call(const shared_ptr<Object> *args, unsigned int count);
+
+private:
+  shared_ptr<Function> f;
+  Function *clause = nullptr;
+  unsigned int count = 0;
+  unsigned int fixed = 0;
+  shared_ptr<Environment> frame;
+  shared_ptr<List> buffer;
+};
+
 shared_ptr<Environment> to_environment(shared_ptr<Object> o);
 } // namespace ml
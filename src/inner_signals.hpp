@@ -7,5 +7,8 @@ enum INNER_SIGNALS {
   SQUARE_BRACKET_CLOSE,
   GRAPH_BRACKET_CLOSE,
   END_OF_TOKENS,
+  RECUR,
+  VALUES,
+  DEOPT,
 };
 }
@@ -1,13 +1,22 @@
+#include "emitter.hpp"
 #include "linenoise.hpp"
 #include "mylisp.hpp"
 #include "parser.hpp"
+#include <fstream>
 #include <iostream>
+#include <sstream>
 
 using namespace std;
 
 int main(int argc, char **argv) {
   ml::Runtime rnt;
-  if (argc == 1) {
+  // mylisp --sealed ...: the core builtins cannot be rebound
+  int first = 1;
+  if (argc > 1 and std::string(argv[1]) == "--sealed") {
+    rnt.env()->seal();
+    first = 2;
+  }
+  if (argc == first) {
     // REPL
     const std::string history_path = "history.txt";
     linenoise::LoadHistory(history_path.c_str());
@@ -24,15 +33,38 @@ int main(int argc, char **argv) {
     }
     linenoise::SaveHistory(history_path.c_str());
     return 0;
+  } else if (std::string(argv[first]) == "--emit-cpp") {
+    // TRANSLATE FILE: mylisp --emit-cpp FILE [-o OUT]
+    if (argc != first + 2 and
+        not(argc == first + 4 and std::string(argv[first + 2]) == "-o")) {
+      cerr << "usage: " << argv[0] << " --emit-cpp FILE [-o OUT]" << endl;
+      return 1;
+    }
+    std::ifstream in(argv[first + 1]);
+    if (not in) {
+      cerr << "cannot open " << argv[first + 1] << endl;
+      return 1;
+    }
+    std::stringstream source;
+    source << in.rdbuf();
+    std::string out = ml::emit_cpp(source.str(), argv[first + 1], rnt.env());
+    if (argc == first + 2) {
+      cout << out;
+      return 0;
+    }
+    std::ofstream file(argv[first + 3]);
+    file << out;
+    return file ? 0 : 1;
   } else {
     // LOAD FILE
     shared_ptr<ml::List> eargv = ml::list();
     ml::Parser p;
-    for (unsigned int i = 2; i < argc; i++) {
+    for (unsigned int i = first + 1; i < argc; i++) {
       eargv->append(p.parse(argv[i]));
     }
     rnt.env()->set(ml::str("*ARGV*"), eargv);
-    ml::rep("(load-file \"" + std::string(argv[1]) + "\")", rnt.env());
+    ml::load_file(argv[first], rnt.env());
+    ml::check_exc();
   }
   return 0;
 }
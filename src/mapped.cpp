@@ -0,0 +1,49 @@
+#include "mapped.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ml {
+
+MappedFile::MappedFile(const std::string &filename) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    return;
+  struct stat info;
+  // files of /proc and /sys say they are empty, they are read as well
+  if (fstat(fd, &info) == 0 and S_ISREG(info.st_mode) and info.st_size > 0) {
+    _size = info.st_size;
+    _data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (_data == MAP_FAILED) {
+      _data = nullptr;
+      _size = 0;
+      close(fd);
+      return;
+    }
+    // the parser goes through the file once, front to back
+    madvise(_data, _size, MADV_SEQUENTIAL);
+  } else {
+    char chunk[4096];
+    ssize_t count;
+    while ((count = read(fd, chunk, sizeof chunk)) > 0)
+      _buffer.append(chunk, count);
+  }
+  close(fd);
+  _open = true;
+}
+
+MappedFile::~MappedFile() {
+  if (_data != nullptr)
+    munmap(_data, _size);
+}
+
+bool MappedFile::is_open() const { return _open; }
+
+std::string_view MappedFile::view() const {
+  if (_data != nullptr)
+    return std::string_view(static_cast<const char *>(_data), _size);
+  return _buffer;
+}
+
+} // namespace ml
@@ -0,0 +1,29 @@
+#pragma once
+#include <string>
+#include <string_view>
+
+namespace ml {
+
+/*
+ * the content of a file, read only: a regular file is mapped in memory and
+ * its pages are read by the kernel as they are touched, anything else (a pipe,
+ * a terminal, an empty file or one of /proc) is read whole into a buffer.
+ * */
+class MappedFile {
+public:
+  MappedFile(const std::string &filename);
+  ~MappedFile();
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  bool is_open() const;
+  // valid as long as the MappedFile lives
+  std::string_view view() const;
+
+private:
+  bool _open = false;
+  void *_data = nullptr;
+  size_t _size = 0;
+  std::string _buffer;
+};
+
+} // namespace ml
@@ -1,250 +1,239 @@
 #include "parser.hpp"
 #include "inner_signals.hpp"
 #include "types.hpp"
+#include <charconv>
 #include <iostream>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 using std::string_view, std::endl, std::cout;
 
 namespace ml {
 
 Parser::Parser() {}
 
-shared_ptr<Object> Parser::parse(std::string input) {
-  _input = input;
-  tokenize();
-
-  // cout << "*******************\n";
-  // for (auto t : tokens)
-  //   cout << t << " ";
-  // cout << endl;
-  // cout << "*******************\n" << endl;
-
-  token_parse_index = 0;
+shared_ptr<Object> Parser::parse(string_view input) {
+  open(input);
   shared_ptr<Vec> root = vec();
-  if (not tokens.empty()) {
-    while (token_parse_index < tokens.size()) {
-      shared_ptr<Object> expr = parse_form();
-      root->append(expr);
-    }
-    if (root->elements.size() == 0)
-      return nil();
-    else if (root->elements.size() == 1)
-      return root->elements[0];
-    else
-      return root;
-  } else
+  for (shared_ptr<Object> expr = read(); expr != nullptr; expr = read())
+    root->append(expr);
+  if (root->elements.size() == 0)
     return nil();
+  else if (root->elements.size() == 1)
+    return root->elements[0];
+  else
+    return root;
 }
 
-void Parser::tokenize() {
-  string_view view(_input);
-  unsigned int index = 0, offset = 0;
+void Parser::open(string_view input) {
+  _input = input;
+  _position = 0;
+  next();
+}
+
+shared_ptr<Object> Parser::read() {
+  if (_token.empty())
+    return nullptr;
+  return parse_form();
+}
+
+/*
+ * the lexer finds the end of spaces, comments, strings and atoms by looking at
+ * a block of 32 (AVX2) or 16 (SSE2) bytes at once: each byte is compared with
+ * every character of a set, and the first match is the lowest bit of the
+ * resulting mask. the bytes after the last whole block, and every byte on
+ * other targets, are looked at one by one.
+ * */
+#if defined(__AVX2__)
+using Block = __m256i;
+constexpr size_t block_size = 32;
+static Block load(const char *p) {
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+}
+static unsigned int matches(Block block, char ch) {
+  return _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, _mm256_set1_epi8(ch)));
+}
+#elif defined(__SSE2__)
+using Block = __m128i;
+constexpr size_t block_size = 16;
+static Block load(const char *p) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+}
+static unsigned int matches(Block block, char ch) {
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8(ch)));
+}
+#endif
 
-  enum TOKEN_TYPE {
-    UNKNOWN,
-    STRING,
-    SPACES,
-    COMMENT,
-  };
+/*
+ * the index of the first character from *from* on that is one of *set*, or
+ * with *in_set* false that is not one of them. the length of the input if
+ * there is none.
+ * */
+template <bool in_set, char... set>
+static size_t find(string_view input, size_t from) {
+#if defined(__AVX2__) or defined(__SSE2__)
+  constexpr unsigned int all = (1ull << block_size) - 1;
+  for (; from + block_size <= input.length(); from += block_size) {
+    Block block = load(input.data() + from);
+    unsigned int mask = (matches(block, set) | ...);
+    if constexpr (not in_set)
+      mask = ~mask & all;
+    if (mask != 0)
+      return from + __builtin_ctz(mask);
+  }
+#endif
+  for (; from < input.length(); from++)
+    if (((input[from] == set) or ...) == in_set)
+      return from;
+  return input.length();
+}
 
-  TOKEN_TYPE current_token = UNKNOWN;
-  auto add_token = [this](string_view token) { this->tokens.push_back(token); };
+// the characters that end a symbol, a number or a keyword
+#define DELIMITERS                                                             \
+  ' ', '\n', '\t', ';', '"', '~', '(', ')', '[', ']', '{', '}', '@', '&', '\'',  \
+      '`', '^'
 
-  while (index + offset < view.length()) {
-    char ch = view.at(index + offset);
-    switch (current_token) {
-    case STRING:
-      if (ch == '"' and index > 0 and view.at(index + offset - 1) != '\\') {
-        current_token = UNKNOWN;
-        add_token(view.substr(index, offset + 1));
-        index += offset + 1;
-        offset = 0;
-      } else
-        offset++;
+/*
+ * reads the token starting at _position, after the spaces and comments before
+ * it. a string token keeps its quotes and its escapes, an unterminated one
+ * runs to the end of the input.
+ * */
+string_view Parser::lex() {
+  while (true) {
+    _position = find<false, ' ', '\n', '\t'>(_input, _position);
+    if (_position >= _input.length() or _input[_position] != ';')
       break;
-    case SPACES:
-      switch (ch) {
-      case ' ':
-      case '\n':
-      case '\t':
-        index++;
-        break;
-      case '"':
-        index += offset;
-        offset = 1;
-        current_token = STRING;
-        break;
-      default:
-        offset = 0;
-        current_token = UNKNOWN;
-      }
-      break;
-    case COMMENT:
-      if (ch == '\n')
-        current_token = UNKNOWN;
-      index++;
+    _position = find<true, '\n'>(_input, _position);
+  }
+  if (_position >= _input.length())
+    return string_view();
+
+  size_t start = _position;
+  switch (_input[start]) {
+  case '"':
+    _position = find<true, '"', '\\'>(_input, _position + 1);
+    while (_position < _input.length() and _input[_position] == '\\')
+      _position = find<true, '"', '\\'>(_input, _position + 2);
+    _position = std::min(_position + 1, _input.length());
+    break;
+  case '~':
+    if (start + 1 < _input.length() and _input[start + 1] == '@') {
+      _position += 2;
       break;
-    case UNKNOWN:
-      switch (ch) {
-      case ' ':
-        if (offset != 0) {
-          add_token(view.substr(index, offset));
-          index += offset;
-          offset = 0;
-        }
-        current_token = SPACES;
-        break;
-      case '"':
-        current_token = STRING;
-        index += offset;
-        offset++;
-        break;
-      case '~':
-        if (view.at(index + offset + 1) == '@') {
-          if (offset != 0)
-            add_token(view.substr(index, offset));
-          add_token(view.substr(index + offset, 2));
-          index += offset + 2;
-          offset = 0;
-          break;
-        }
-      case '(':
-      case ')':
-      case '[':
-      case ']':
-      case '{':
-      case '}':
-      case '@':
-      case '&':
-      case '\'':
-      case '`':
-      case '^':
-        if (offset != 0)
-          add_token(view.substr(index, offset));
-        add_token(view.substr(index + offset, 1));
-        index += offset + 1;
-        offset = 0;
-        break;
-      case '\n':
-      case '\t':
-        if (offset > 0)
-          add_token(view.substr(index, offset));
-        index += offset + 1;
-        offset = 0;
-        break;
-      case ';':
-        current_token = COMMENT;
-        if (offset > 0)
-          add_token(view.substr(index, offset));
-        index += offset + 1;
-        offset = 0;
-        break;
-      default:
-        offset++;
-      }
     }
+  case '(':
+  case ')':
+  case '[':
+  case ']':
+  case '{':
+  case '}':
+  case '@':
+  case '&':
+  case '\'':
+  case '`':
+  case '^':
+    _position++;
+    break;
+  default:
+    _position = find<true, DELIMITERS>(_input, _position);
+  }
 #ifdef DEBUG_Parser_tokenize_steps
-    for (auto tok : tokens)
-      cout << tok << " ";
-    cout << endl << view << endl;
-    for (unsigned int i = 0; i < view.length(); i++)
-      cout << (i == index ? '*' : ' ');
-    cout << endl;
-    for (unsigned int i = 0; i < view.length(); i++)
-      cout << (i == index + offset ? '*' : ' ');
-    cout << endl;
-    cout << " index: " << index << endl << " offset: " << offset << endl;
-    std::cin.get();
+  cout << _input.substr(start, _position - start) << endl;
 #endif
-  }
-  if (view.length() > 0 and index < view.length()) {
-    add_token(view.substr(index, offset));
-  }
+  return _input.substr(start, _position - start);
 }
 
-std::string_view Parser::peak() { return tokens[token_parse_index]; }
+std::string_view Parser::peak() { return _token; }
 
-std::string_view Parser::next() { return tokens[++token_parse_index]; }
-
-void Parser::reset() { token_parse_index = -1; }
+std::string_view Parser::next() {
+  _token = lex();
+  return _token;
+}
 
 #ifdef DEBUG_Parser_debug
 void Parser::debug() {
+  size_t position = _position;
+  std::string_view token = _token;
   std::string token_pri = "";
-  for (auto token : tokens)
-    token_pri += std::string(token) + " ";
+  _position = 0;
+  for (string_view t = lex(); not t.empty(); t = lex())
+    token_pri += std::string(t) + " ";
   cout << token_pri << endl;
+  _position = position;
+  _token = token;
 }
 #endif
 
 shared_ptr<Object> Parser::parse_form() {
 #ifdef DEBUG_Parser_parse_form_steps
-  cout << tokens[token_parse_index] << endl << token_parse_index << endl;
+  cout << _token << endl << _position << endl;
   std::cin.get();
 #endif
-  if (token_parse_index < tokens.size()) {
+  string_view token = peak();
+  if (not token.empty()) {
 #ifdef DEBUG_Parser_parse_form_steps
-    cout << "parsing token " << tokens[token_parse_index] << endl;
+    cout << "parsing token " << token << endl;
 #endif
-    if (tokens[token_parse_index] == "(") {
+    if (token == "(") {
       brackets.push(CURVE);
-      token_parse_index++;
+      next();
       return parse_list();
-    } else if (tokens[token_parse_index] == ")") {
-      token_parse_index++;
+    } else if (token == ")") {
+      next();
       return to_obj(signal(CURVE_BRACKET_CLOSE));
-    } else if (tokens[token_parse_index] == "[") {
+    } else if (token == "[") {
       brackets.push(SQUARE);
-      token_parse_index++;
+      next();
       return parse_vec();
-    } else if (tokens[token_parse_index] == "]") {
-      token_parse_index++;
+    } else if (token == "]") {
+      next();
       return to_obj(signal(SQUARE_BRACKET_CLOSE));
-    } else if (tokens[token_parse_index] == "{") {
+    } else if (token == "{") {
       brackets.push(GRAPH);
-      token_parse_index++;
+      next();
       return parse_dict();
-    } else if (tokens[token_parse_index] == "}") {
-      token_parse_index++;
+    } else if (token == "}") {
+      next();
       return to_obj(signal(GRAPH_BRACKET_CLOSE));
-    } else if (tokens[token_parse_index] == "'") {
+    } else if (token == "'") {
       shared_ptr<List> quoted_list = list();
       quoted_list->append(symbol("quote"));
-      token_parse_index++;
+      next();
       quoted_list->append(parse_form());
-      // token_parse_index++;
       return quoted_list;
-    } else if (tokens[token_parse_index] == "`") {
+    } else if (token == "`") {
       shared_ptr<List> quasiquoted_list = list();
       quasiquoted_list->append(symbol("quasiquote"));
-      token_parse_index++;
+      next();
       quasiquoted_list->append(parse_form());
-      // token_parse_index++;
       return quasiquoted_list;
-    } else if (tokens[token_parse_index] == "~") {
+    } else if (token == "~") {
       shared_ptr<List> unquoted_list = list();
       unquoted_list->append(symbol("unquote"));
-      token_parse_index++;
+      next();
       unquoted_list->append(parse_form());
       return unquoted_list;
-    } else if (tokens[token_parse_index] == "~@") {
+    } else if (token == "~@") {
       shared_ptr<List> splice_unquoted_list = list();
       splice_unquoted_list->append(symbol("splice-unquote"));
-      token_parse_index++;
+      next();
       splice_unquoted_list->append(parse_form());
       return splice_unquoted_list;
-    } else if (tokens[token_parse_index] == "^") {
+    } else if (token == "^") {
+      // ^META FORM reads as (with-meta FORM META)
       shared_ptr<List> with_meta_list = list();
       with_meta_list->append(symbol("with-meta"));
-      token_parse_index += 2;
+      next();
+      shared_ptr<Object> meta = parse_form();
       with_meta_list->append(parse_form());
-      token_parse_index -= 2;
-      with_meta_list->append(parse_form());
-      token_parse_index += 2;
+      with_meta_list->append(meta);
       return with_meta_list;
-    } else if (tokens[token_parse_index] == "@") {
+    } else if (token == "@") {
       shared_ptr<List> deref_list = list();
       deref_list->append(symbol("deref"));
-      token_parse_index++;
+      next();
       deref_list->append(parse_form());
       return deref_list;
     } else {
@@ -258,7 +247,7 @@ shared_ptr<Object> Parser::parse_form() {
 
 shared_ptr<List> Parser::parse_list() {
   shared_ptr<List> ret = list();
-  while (token_parse_index < tokens.size()) {
+  while (not _token.empty()) {
     shared_ptr<Object> el = parse_form();
     if (el->type == SIGNAL) {
       switch (to_signal(el)->_value) {
@@ -275,6 +264,9 @@ shared_ptr<List> Parser::parse_list() {
       case GRAPH_BRACKET_CLOSE:
       case END_OF_TOKENS:
       case QUIT:
+      case RECUR:
+      case VALUES:
+      case DEOPT:
         cout << "ERROR balancing ()" << endl;
         exit(1);
       }
@@ -287,7 +279,7 @@ shared_ptr<List> Parser::parse_list() {
 
 shared_ptr<Vec> Parser::parse_vec() {
   shared_ptr<Vec> ret = vec();
-  while (token_parse_index < tokens.size()) {
+  while (not _token.empty()) {
     shared_ptr<Object> el = parse_form();
     if (el->type == SIGNAL) {
       switch (to_signal(el)->_value) {
@@ -304,6 +296,9 @@ shared_ptr<Vec> Parser::parse_vec() {
       case GRAPH_BRACKET_CLOSE:
       case END_OF_TOKENS:
       case QUIT:
+      case RECUR:
+      case VALUES:
+      case DEOPT:
         cout << "ERROR balancing []" << endl;
         exit(1);
       }
@@ -316,11 +311,14 @@ shared_ptr<Vec> Parser::parse_vec() {
 
 shared_ptr<Dict> Parser::parse_dict() {
   shared_ptr<Dict> ret = dict();
-  while (token_parse_index < tokens.size()) {
+  while (not _token.empty()) {
     shared_ptr<Object> key = parse_form();
     switch (key->type) {
     case KEYWORD:
-    case STRING: {
+    case STRING:
+    case SYMBOL:
+    case VEC:
+    case DICT: {
       shared_ptr<Object> value = parse_form();
       if (value->type == SIGNAL) {
         switch (to_signal(value)->_value) {
@@ -329,11 +327,19 @@ shared_ptr<Dict> Parser::parse_dict() {
         case GRAPH_BRACKET_CLOSE:
         case END_OF_TOKENS:
         case QUIT:
+        case RECUR:
+        case VALUES:
+        case DEOPT:
           cout << "error balancing {}" << endl;
           return to_dict(nil());
         }
       } else {
-        ret->append(key, value);
+        /*
+         * symbols, vectors and maps as keys only make sense in the
+         * destructuring patterns of let* and fn*, as in {a :a [b c] :v}:
+         * evaluating a map with such a key raises an error.
+         * */
+        ret->map.insert_or_assign(key, value);
       }
     } break;
     case SIGNAL: {
@@ -346,7 +352,8 @@ shared_ptr<Dict> Parser::parse_dict() {
       }
     } break;
     default:
-      cout << "only keyword and string are valid keys" << endl;
+      cout << "only keywords, strings, symbols, vectors and maps can be keys"
+           << endl;
       return to_dict(nil());
     }
   }
@@ -354,25 +361,57 @@ shared_ptr<Dict> Parser::parse_dict() {
   return to_dict(nil());
 }
 
+/*
+ * decodes *token* as a number literal, read in place: an optional sign, then
+ * 0x and hex digits, or decimal digits with an optional fraction and
+ * exponent. integers are read as such, so that they are exact up to 2^53.
+ * false when the token is something else (-, ->, 1+ ...).
+ * */
+static bool number_literal(string_view token, double &out) {
+  bool negative = false;
+  if (token[0] == '-' or token[0] == '+') {
+    negative = token[0] == '-';
+    token.remove_prefix(1);
+  }
+  if (token.empty() or not isdigit(token[0]))
+    return false;
+  const char *end = token.data() + token.length();
+
+  if (token.length() > 2 and token[0] == '0' and
+      (token[1] == 'x' or token[1] == 'X')) {
+    unsigned long long value;
+    auto [last, error] = std::from_chars(token.data() + 2, end, value, 16);
+    if (error != std::errc() or last != end)
+      return false;
+    out = negative ? -double(value) : double(value);
+    return true;
+  }
+  long long integer;
+  auto [last, error] = std::from_chars(token.data(), end, integer);
+  if (error == std::errc() and last == end) {
+    out = negative ? -double(integer) : double(integer);
+    return true;
+  }
+  double value;
+  auto [fraction_end, fraction_error] =
+      std::from_chars(token.data(), end, value);
+  if (fraction_error != std::errc() or fraction_end != end)
+    return false;
+  out = negative ? -value : value;
+  return true;
+}
+
 shared_ptr<Object> Parser::parse_atom() {
-  string_view token = tokens[token_parse_index];
-  token_parse_index++;
+  string_view token = peak();
+  next();
 
   char ch = token.at(0);
+  double value;
   if (ch == '"') {
     return str(std::string(token.substr(1, token.length() - 2)));
-  } else if (isdigit(ch)) {
-    bool is_number = true;
-    for (char c : token) {
-      if (not(isdigit(c) or c == '.')) {
-        is_number = false;
-        break;
-      }
-    }
-    if (is_number)
-      return number(std::stod(std::string(token)));
-    else
-      return symbol(std::string(token));
+  } else if ((isdigit(ch) or ch == '-' or ch == '+') and
+             number_literal(token, value)) {
+    return number(value);
   } else if (ch == ':') {
     return keyword(std::string(token));
   } else
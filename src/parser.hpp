@@ -7,7 +7,12 @@ namespace ml {
 class Parser {
 public:
   Parser();
-  shared_ptr<Object> parse(std::string input);
+  // *input* is only read while parsing, the forms returned own their text
+  shared_ptr<Object> parse(std::string_view input);
+  // reading the forms of *input* one by one: read() returns the next form,
+  // nullptr once the input is over
+  void open(std::string_view input);
+  shared_ptr<Object> read();
 #ifdef DEBUG_Parser_debug
   void debug();
 #endif
@@ -17,14 +22,15 @@ private:
   shared_ptr<List>   parse_list();
   shared_ptr<Vec>    parse_vec();
   shared_ptr<Dict>   parse_dict();
-  void tokenize();
+  std::string_view lex();
   std::string_view peak();
   std::string_view next();
-  void reset();
 
-  std::string _input;
-  int token_parse_index;
-  std::vector<std::string_view> tokens;
+  // the input is lexed on demand: _token is the token the parser is at, and
+  // _position where the one after it starts. an empty _token is the end
+  std::string_view _input;
+  size_t _position = 0;
+  std::string_view _token;
   enum BRACKETS {
     CURVE,
     SQUARE,
@@ -1,9 +1,12 @@
 #include "repl.hpp"
+#include "analyzer.hpp"
 #include "core.hpp"
 #include "debug.hpp"
+#include "mapped.hpp"
 #include "parser.hpp"
 #include "printer.hpp"
 #include "types.hpp"
+#include <algorithm>
 #include <functional>
 #include <iostream>
 #include <memory>
@@ -25,17 +28,47 @@ Runtime::Runtime() {
 const vector<std::string> keywords = {
     "fn*",         "if",          "do",    "let*",       "def!",
     "defmacro!",   "expandmacro", "quote", "quasiquote", "quasiquoteexpand",
-    "macroexpand", "try*",        "catch*"};
+    "macroexpand", "try*",        "catch*", "loop",      "recur",
+    "dotimes",     "doseq",       "cond",   "and",       "or",
+    "when",        "match",       "values", "let-values"};
 
 shared_ptr<Environment> Runtime::env() { return core_env; }
 
 std::string rep(std::string input, shared_ptr<Environment> rep_env) {
-  return PRINT(EVAL(READ(input), rep_env));
+  shared_ptr<Object> ret = EVAL(READ(input), rep_env);
+  report_unresolved();
+  return PRINT(ret);
+}
+
+/*
+ * reads, evaluates and drops the forms of a file one at a time: a form sees
+ * the macros the forms before it define, and only the form being evaluated is
+ * kept in memory. the parser reads the mapped file itself. the globals still
+ * unresolved are reported once the file is read, a function may use one that
+ * a later form defines.
+ * */
+shared_ptr<Object> load_file(const std::string &filename,
+                             shared_ptr<Environment> env) {
+  MappedFile source(filename);
+  if (not source.is_open())
+    return Runtime::ret_exception("load-file: cannot open " + filename);
+
+  Parser p;
+  p.open(source.view());
+  shared_ptr<Object> ret = nil();
+  for (shared_ptr<Object> form = p.read(); form != nullptr; form = p.read()) {
+    ret = EVAL(form, env);
+    if (ret->type == EXCEPTION)
+      break;
+  }
+  report_unresolved();
+  return ret->type == EXCEPTION ? ret : nil();
 }
 
 void check_exc() {
-  // if (Runtime::unhandled_exc->type != NIL and not catching) {
-  if (Runtime::unhandled_exc->type == EXCEPTION) {
+  if (Runtime::unhandled_exc->type != NIL and not catching) {
+    // the program ends here, before load_file can report what is undefined
+    report_unresolved();
     cout << "----------------------------------" << endl;
     cout << "there is an unhandled exception" << endl;
     cout << debug_object(Runtime::unhandled_exc) << endl;
@@ -168,16 +201,8 @@ bool is_macro_call(shared_ptr<Object> ast, shared_ptr<Environment> env) {
   if (ast->type == LIST and to_list(ast)->elements.size() > 1 and
       to_list(ast)->elements[0]->type == SYMBOL) {
     shared_ptr<Symbol> ast_as_symbol = to_symbol(to_list(ast)->elements[0]);
-    if (ast_as_symbol->value() == "if" or ast_as_symbol->value() == "fn*" or
-        ast_as_symbol->value() == "def!" or ast_as_symbol->value() == "let*" or
-        ast_as_symbol->value() == "defmacro!" or
-        ast_as_symbol->value() == "expandmacro" or
-        ast_as_symbol->value() == "quote" or ast_as_symbol->value() == "do" or
-        ast_as_symbol->value() == "quasiquoteexpand" or
-        ast_as_symbol->value() == "macroexpand" or
-        ast_as_symbol->value() == "quasiquote" or
-        ast_as_symbol->value() == "try*" or
-        ast_as_symbol->value() == "catch*") {
+    if (std::find(keywords.begin(), keywords.end(), ast_as_symbol->value()) !=
+        keywords.end()) {
       return false;
     }
     shared_ptr<Object> f_m = env->get(to_symbol(to_list(ast)->elements[0]));
@@ -200,6 +225,14 @@ shared_ptr<Object> macroexpand(shared_ptr<Object> ast,
   return ast;
 }
 
+/*
+ * whether an exception is pending inside a try*: check_exc() lets the
+ * evaluation go on there, it must stop and go back to the catch*.
+ * */
+static bool raised() {
+  return catching and Runtime::unhandled_exc->type != NIL;
+}
+
 shared_ptr<Object> EVAL(shared_ptr<Object> input,
                         shared_ptr<Environment> repl_env) {
   while (true) {
@@ -210,6 +243,8 @@ shared_ptr<Object> EVAL(shared_ptr<Object> input,
     }
 
     check_exc();
+    if (raised())
+      return Runtime::unhandled_exc;
     input = macroexpand(input, repl_env);
     if (input->type != LIST) {
       shared_ptr<Object> ret;
@@ -232,20 +267,22 @@ shared_ptr<Object> EVAL(shared_ptr<Object> input,
                   SYMBOL and
               to_symbol(to_list(input_as_list->elements[2])->elements[0])
                       ->value() == "catch*") {
+            bool was_catching = catching;
             catching = true;
             shared_ptr<Object> tried_eval =
                 EVAL(input_as_list->elements[1], repl_env);
-            if (tried_eval->type != EXCEPTION) {
-              catching = false;
-              input = tried_eval;
-              continue;
+            if (tried_eval->type != EXCEPTION and
+                Runtime::unhandled_exc->type == NIL) {
+              catching = was_catching;
+              return tried_eval;
             } else {
               repl_env = make_shared<Environment>(repl_env);
               repl_env->set(
                   to_symbol(to_list(input_as_list->elements[2])->elements[1]),
-                  tried_eval);
+                  Runtime::unhandled_exc->type != NIL ? Runtime::unhandled_exc
+                                                      : tried_eval);
               input = to_list(input_as_list->elements[2])->elements[2];
-              catching = false;
+              catching = was_catching;
               Runtime::unhandled_exc = nil();
               continue;
             }
@@ -254,8 +291,22 @@ shared_ptr<Object> EVAL(shared_ptr<Object> input,
                 "try*/catch*: syntax error. it must be (try* CODE (catch* "
                 "error ERROR_HANDLE_CODE))");
           }
+        } else if (first_as_symbol->value() == "loop" or
+                   first_as_symbol->value() == "recur" or
+                   first_as_symbol->value() == "dotimes" or
+                   first_as_symbol->value() == "doseq" or
+                   first_as_symbol->value() == "cond" or
+                   first_as_symbol->value() == "and" or
+                   first_as_symbol->value() == "or" or
+                   first_as_symbol->value() == "when" or
+                   first_as_symbol->value() == "match" or
+                   first_as_symbol->value() == "values" or
+                   first_as_symbol->value() == "let-values") {
+          return evaluate(input, repl_env);
         } else if (first_as_symbol->value() == "fn*") {
-          if (input_as_list->elements.size() == 3 and
+          if (is_multi_arity(input_as_list) or uses_destructuring(input_as_list))
+            return evaluate(input, repl_env);
+          else if (input_as_list->elements.size() == 3 and
               input_as_list->elements[1]->type == LIST) {
             bool valid = true;
             for (auto el : to_list(input_as_list->elements[1])->elements)
@@ -264,8 +315,11 @@ shared_ptr<Object> EVAL(shared_ptr<Object> input,
                 break;
               }
             if (valid) {
-              return func(to_list(input_as_list->elements[1]),
-                          input_as_list->elements[2], repl_env, "");
+              shared_ptr<Function> f =
+                  func(to_list(input_as_list->elements[1]),
+                       input_as_list->elements[2], repl_env, "");
+              analyze_function(f);
+              return f;
             } else {
               cout << "fn* parameters must be all symbols" << endl;
               exit(1);
@@ -283,7 +337,10 @@ shared_ptr<Object> EVAL(shared_ptr<Object> input,
                 largs->append(el);
               }
             if (valid) {
-              return func(largs, input_as_list->elements[2], repl_env, "");
+              shared_ptr<Function> f =
+                  func(largs, input_as_list->elements[2], repl_env, "");
+              analyze_function(f);
+              return f;
             } else {
               cout << "fn* parameters must be all symbols" << endl;
               exit(1);
@@ -297,6 +354,8 @@ shared_ptr<Object> EVAL(shared_ptr<Object> input,
             return to_obj(nil());
           }
         } else if (first_as_symbol->value() == "let*") {
+          if (uses_destructuring(input_as_list))
+            return evaluate(input, repl_env);
           if (input_as_list->elements.size() == 3) {
             shared_ptr<Environment> new_env =
                 std::make_shared<Environment>(repl_env);
@@ -360,7 +419,10 @@ shared_ptr<Object> EVAL(shared_ptr<Object> input,
             if (key->type == SYMBOL) {
               shared_ptr<Object> evalued_value = EVAL(value, repl_env);
               check_exc();
+              if (raised())
+                return Runtime::unhandled_exc;
               repl_env->set(key, evalued_value);
+              check_exc();
               return evalued_value;
             } else {
               cout << "def! accept only symbol as key" << endl;
@@ -381,6 +443,7 @@ shared_ptr<Object> EVAL(shared_ptr<Object> input,
               // check_exc();
               evalued_value->is_macro = true;
               repl_env->set(key, evalued_value);
+              check_exc();
               return evalued_value;
             } else {
               cout << "def! accept only symbol as key" << endl;
@@ -428,7 +491,9 @@ shared_ptr<Object> EVAL(shared_ptr<Object> input,
             shared_ptr<Object> ret = nil();
             for (unsigned int i = 1; i < input_as_list->elements.size() - 1;
                  i++) {
-              eval_ast(input_as_list->elements[i], repl_env);
+              EVAL(input_as_list->elements[i], repl_env);
+              if (raised())
+                return Runtime::unhandled_exc;
             }
             input = input_as_list->elements[input_as_list->elements.size() - 1];
             continue;
@@ -445,8 +510,7 @@ shared_ptr<Object> EVAL(shared_ptr<Object> input,
           }
         } else if (first_as_symbol->value() == "quasiquote") {
           if (input_as_list->elements.size() == 2) {
-            input = quasiquote(input_as_list->elements[1]);
-            continue;
+            return evaluate(input, repl_env);
           } else {
             cout << "quasiquote take one parameter" << endl;
             exit(1);
@@ -462,6 +526,8 @@ shared_ptr<Object> EVAL(shared_ptr<Object> input,
       }
 
       shared_ptr<List> evaluated_input = to_list(eval_ast(input, repl_env));
+      if (raised())
+        return Runtime::unhandled_exc;
       shared_ptr<Object> first_item_evaluated = evaluated_input->elements[0];
       switch (first_item_evaluated->type) {
       case FUNCTION: {
@@ -473,6 +539,18 @@ shared_ptr<Object> EVAL(shared_ptr<Object> input,
             args->append(evaluated_input->elements[i]);
           }
           return f->call(args);
+        } else if (f->code != nullptr) {
+          Function *clause = f->dispatch(evaluated_input->elements.size() - 1);
+          if (clause == nullptr)
+            return to_obj(Runtime::ret_exception(
+                "Funcion <" + f->calling_env->get_key(f->shared_from_this()) +
+                ">: wrong number of parameters"));
+          Frame frame(f->calling_env, clause->code->frame_size);
+          if (not clause->bind(frame.env(), evaluated_input, 1))
+            return to_obj(Runtime::ret_exception(
+                "Funcion <" + f->calling_env->get_key(f->shared_from_this()) +
+                ">: wrong number of parameters"));
+          return clause->code->body(frame.env());
         } else {
           shared_ptr<Environment> closure =
               make_shared<Environment>(f->calling_env);
@@ -7,11 +7,15 @@ shared_ptr<Object> READ(std::string input);
 shared_ptr<Object> EVAL(shared_ptr<Object> input, shared_ptr<Environment> env);
 std::string PRINT(shared_ptr<Object> input);
 std::string rep(std::string input, shared_ptr<Environment> rep_env);
+shared_ptr<Object> load_file(const std::string &filename,
+                             shared_ptr<Environment> env);
 shared_ptr<Object> quasiquote(shared_ptr<Object> ast);
 bool is_macro_call(shared_ptr<Object> ast, shared_ptr<Environment> env);
 shared_ptr<Object> macroexpand(shared_ptr<Object> ast,
                                shared_ptr<Environment> env);
+void check_exc();
 extern const std::vector<std::string> keywords;
+extern bool catching;
 
 class Runtime {
 public:
@@ -72,7 +72,7 @@ const bool Number::operator==(const shared_ptr<Number> other) {
 }
 // STRING
 
-Str::Str(std::string value) : Object(STRING) { this->_value = value; }
+Str::Str(std::string value) : Object(STRING), _value(std::move(value)) {}
 
 const std::string &Str::value() const { return _value; }
 
@@ -211,6 +211,49 @@ const bool Vec::operator==(const shared_ptr<Vec> other) {
 }
 // DICT
 
+size_t KeyHash::operator()(const shared_ptr<Object> &key) const {
+  switch (key->type) {
+  case NUMBER: {
+    double n = to_number(key)->value();
+    return std::hash<double>()(n == 0 ? 0 : n); // -0 is 0
+  }
+  case STRING:
+    return std::hash<std::string>()(to_str(key)->value());
+  case KEYWORD:
+    return std::hash<std::string>()(to_keyword(key)->value()) ^ KEYWORD;
+  case SYMBOL:
+    return std::hash<std::string>()(to_symbol(key)->value()) ^ SYMBOL;
+  case BOOL:
+    return to_bool(key)->value() ? size_t(BOOL) : ~size_t(BOOL);
+  case NIL:
+    return NIL;
+  default:
+    return std::hash<Object *>()(key.get());
+  }
+}
+
+bool KeyEqual::operator()(const shared_ptr<Object> &a,
+                          const shared_ptr<Object> &b) const {
+  if (a->type != b->type)
+    return false;
+  switch (a->type) {
+  case NUMBER:
+    return to_number(a)->value() == to_number(b)->value();
+  case STRING:
+    return to_str(a)->value() == to_str(b)->value();
+  case KEYWORD:
+    return to_keyword(a)->value() == to_keyword(b)->value();
+  case SYMBOL:
+    return to_symbol(a)->value() == to_symbol(b)->value();
+  case BOOL:
+    return to_bool(a)->value() == to_bool(b)->value();
+  case NIL:
+    return true;
+  default:
+    return a == b;
+  }
+}
+
 Dict::Dict() : Object(DICT), meta(nil()) {}
 
 void Dict::append(shared_ptr<Object> key, shared_ptr<Object> value) {
@@ -313,7 +356,8 @@ Function::Function(shared_ptr<List> arguments, shared_ptr<Object> expression,
    * the function is called.
    * */
   for (unsigned int i = 0; i < arguments->elements.size(); i++) {
-    if (to_symbol(arguments->elements[i])->value() == "&") {
+    if (arguments->elements[i]->type == SYMBOL and
+        to_symbol(arguments->elements[i])->value() == "&") {
       if (i == arguments->elements.size() - 2) {
         last_is_variadic = i;
       } else {
@@ -328,8 +372,7 @@ Function::Function(shared_ptr<List> arguments, shared_ptr<Object> expression,
     this->arguments = list();
     for (unsigned int i = 0; i < arguments->elements.size(); i++)
       if (i != arguments->elements.size() - 2) // skip the & symbol
-        this->arguments->append(
-            symbol(to_symbol(arguments->elements[i])->value()));
+        this->arguments->append(arguments->elements[i]);
   } else {
     this->arguments = arguments;
   }
@@ -338,10 +381,69 @@ Function::Function(shared_ptr<List> arguments, shared_ptr<Object> expression,
   this->is_macro = is_macro;
 }
 
+/*
+ * binds the elements of *args* starting from *first* to the slots of the frame
+ * of an analyzed function: the fixed parameters first and then, for a variadic
+ * function, the list of the remaining values. returns false if the number of
+ * values does not match the parameters.
+ * */
+bool Function::bind(const shared_ptr<Environment> &frame,
+                    const shared_ptr<List> &args, unsigned int first) {
+  unsigned int given = args->elements.size() - first;
+  if (last_is_variadic >= 0) {
+    if (given < last_is_variadic)
+      return false;
+    for (unsigned int i = 0; i < last_is_variadic; i++)
+      frame->slots[i] = args->elements[first + i];
+    shared_ptr<List> varargs = list();
+    for (unsigned int i = first + last_is_variadic; i < args->elements.size();
+         i++)
+      varargs->append(args->elements[i]);
+    frame->slots[last_is_variadic] = varargs;
+  } else {
+    if (given != arguments->elements.size())
+      return false;
+    for (unsigned int i = 0; i < given; i++)
+      frame->slots[i] = args->elements[first + i];
+  }
+  return true;
+}
+
+bool Function::multi_arity() const {
+  return code != nullptr and
+         (code->variadic != nullptr or not code->arities.empty());
+}
+/*
+ * the function to run for a call with *count* arguments: the clause of a
+ * multi-arity function, or nullptr if none takes them, and the function
+ * itself otherwise.
+ * */
+Function *Function::dispatch(unsigned int count) {
+  if (not multi_arity())
+    return this;
+  if (count < code->arities.size() and code->arities[count] != nullptr)
+    return code->arities[count].get();
+  if (code->variadic != nullptr and
+      count >= code->variadic->last_is_variadic)
+    return code->variadic.get();
+  return nullptr;
+}
 shared_ptr<Object> Function::call(shared_ptr<List> args) {
   if (compiled)
     return f(args);
-  else {
+  else if (code != nullptr) {
+    Function *clause = dispatch(args->elements.size());
+    if (clause == nullptr)
+      return to_obj(Runtime::ret_exception(
+          "Funcion <" + calling_env->get_key(shared_from_this()) +
+          ">: wrong number of parameters"));
+    Frame frame(calling_env, clause->code->frame_size);
+    if (not clause->bind(frame.env(), args))
+      return to_obj(Runtime::ret_exception(
+          "Funcion <" + calling_env->get_key(shared_from_this()) +
+          ">: wrong number of parameters"));
+    return clause->code->body(frame.env());
+  } else {
     shared_ptr<Environment> closure = make_shared<Environment>(calling_env);
     if (last_is_variadic >= 0) {
       if (arguments->elements.size() >= last_is_variadic) {
@@ -382,7 +484,7 @@ shared_ptr<Nil> nil() { return make_shared<Nil>(); }
 shared_ptr<Symbol> symbol(std::string s) { return make_shared<Symbol>(s); }
 shared_ptr<Bool> boolean(bool b) { return make_shared<Bool>(b); }
 shared_ptr<Keyword> keyword(std::string s) { return make_shared<Keyword>(s); }
-shared_ptr<Str> str(std::string s) { return make_shared<Str>(s); }
+shared_ptr<Str> str(std::string s) { return make_shared<Str>(std::move(s)); }
 shared_ptr<Number> number(double n) { return make_shared<Number>(n); }
 shared_ptr<List> list() { return make_shared<List>(); }
 shared_ptr<Vec> vec() { return make_shared<Vec>(); }
@@ -169,12 +169,25 @@ public:
 
 // DICT
 
+/*
+ * the keys of a Dict are compared by value when they are numbers, strings,
+ * keywords, symbols, booleans or nil, and by identity otherwise.
+ * */
+struct KeyHash {
+  size_t operator()(const shared_ptr<Object> &key) const;
+};
+struct KeyEqual {
+  bool operator()(const shared_ptr<Object> &a,
+                  const shared_ptr<Object> &b) const;
+};
+
 class Dict : public Object {
 public:
   Dict();
   shared_ptr<Object> operator[](shared_ptr<Object> key);
   void append(shared_ptr<Object> key, shared_ptr<Object> value);
-  std::unordered_map<shared_ptr<Object>, shared_ptr<Object>> map;
+  std::unordered_map<shared_ptr<Object>, shared_ptr<Object>, KeyHash, KeyEqual>
+      map;
   shared_ptr<Object> meta;
   const bool operator==(const shared_ptr<Dict> other);
 };
@@ -182,6 +195,29 @@ public:
 // FUNCTION
 
 class Environment;
+/*
+ * body of an interpreted function after analysis (see analyzer.hpp): a tree
+ * of closures taking the frame of the call and returning the result.
+ */
+using Compiled =
+    std::function<shared_ptr<Object>(const shared_ptr<Environment> &)>;
+
+class Function;
+
+/*
+ * what the analysis of a fn* produces, shared by every function the fn*
+ * creates: the body and the size of its frame, or the clauses of a
+ * multi-arity fn* indexed by the number of arguments they take and its
+ * variadic clause. the frames of the clauses are created in the calling_env
+ * of the function called.
+ * */
+struct Code {
+  Compiled body;
+  unsigned int frame_size = 0;
+  vector<shared_ptr<Function>> arities;
+  shared_ptr<Function> variadic;
+};
+
 class Function : public Object, public std::enable_shared_from_this<Function> {
 public:
   Function(std::function<shared_ptr<Object>(shared_ptr<List>)> f,
@@ -190,12 +226,20 @@ public:
            shared_ptr<Environment> env, std::string name, std::string help,
            bool is_macro = false);
   shared_ptr<Object> call(shared_ptr<List> args);
+  Function *dispatch(unsigned int count);
+  bool multi_arity() const;
+  bool bind(const shared_ptr<Environment> &frame, const shared_ptr<List> &args,
+            unsigned int first = 0);
   bool compiled;
+  // a builtin without side effects, see fold() in analyzer.cpp
+  bool pure = false;
   std::string name;
   shared_ptr<List> arguments;
   shared_ptr<Object> expression;
   shared_ptr<Environment> calling_env;
   int last_is_variadic = -1;
+  // set once the function has been analyzed, a closure only copies the pointer
+  shared_ptr<const Code> code;
   shared_ptr<Object> meta;
 
 private: